@@ -0,0 +1,231 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "adapter_selection.h"
+
+// Optional features the renderer makes use of when the adapter has them
+static const WGPUFeatureName optionalFeatures[] = {
+    WGPUFeatureName_TimestampQuery,
+    WGPUFeatureName_IndirectFirstInstance,
+    WGPUFeatureName_TextureCompressionBC,
+    WGPUFeatureName_TextureCompressionETC2
+};
+
+// The spec's default maxStorageBufferBindingSize
+#define DEFAULT_STORAGE_BINDING_SIZE (128ull << 20)
+
+const char* webgpu_backend_name() {
+#if defined(WEBGPU_BACKEND_DAWN)
+    return "Dawn";
+#elif defined(WEBGPU_BACKEND_WGPU)
+    return "wgpu-native";
+#else
+    return "unknown";
+#endif
+}
+
+static const char* adapter_type_name(WGPUAdapterType type) {
+    switch (type) {
+        case WGPUAdapterType_DiscreteGPU: return "discrete GPU";
+        case WGPUAdapterType_IntegratedGPU: return "integrated GPU";
+        case WGPUAdapterType_CPU: return "CPU";
+        default: return "unknown";
+    }
+}
+
+static const char* backend_type_name(WGPUBackendType type) {
+    switch (type) {
+        case WGPUBackendType_Null: return "Null";
+        case WGPUBackendType_WebGPU: return "WebGPU";
+        case WGPUBackendType_D3D11: return "D3D11";
+        case WGPUBackendType_D3D12: return "D3D12";
+        case WGPUBackendType_Metal: return "Metal";
+        case WGPUBackendType_Vulkan: return "Vulkan";
+        case WGPUBackendType_OpenGL: return "OpenGL";
+        case WGPUBackendType_OpenGLES: return "OpenGLES";
+        default: return "unknown";
+    }
+}
+
+typedef struct AdapterRequest {
+    WGPUAdapter adapter;
+    bool done; // also set when the request failed
+} AdapterRequest;
+
+static void request_adapter_callback(WGPURequestAdapterStatus status, WGPUAdapter adapter, WGPUStringView message, void* userdata1, void* userdata2) {
+    AdapterRequest* request = (AdapterRequest*)userdata1;
+    if (status == WGPURequestAdapterStatus_Success) {
+        request->adapter = adapter;
+    }
+    request->done = true;
+}
+
+static WGPUAdapter request_adapter(WGPUInstance instance, WGPUPowerPreference powerPreference, bool fallback) {
+    WGPURequestAdapterOptions adapterOpts = {};
+    adapterOpts.nextInChain = nullptr;
+    adapterOpts.powerPreference = powerPreference;
+    adapterOpts.forceFallbackAdapter = fallback;
+
+    AdapterRequest request = {nullptr, false};
+    WGPURequestAdapterCallbackInfo callbackInfo = {};
+    callbackInfo.callback = &request_adapter_callback;
+    callbackInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+    callbackInfo.userdata1 = &request;
+    wgpuInstanceRequestAdapter(instance,&adapterOpts,callbackInfo);
+
+    while (!request.done) {
+        // Wait for the instance to give us the adapter
+        wgpuInstanceProcessEvents(instance);
+    }
+    return request.adapter;
+}
+
+std::vector<AdapterCandidate> adapter_enumerate(WGPUInstance instance) {
+    std::vector<AdapterCandidate> candidates;
+    const struct {
+        WGPUPowerPreference powerPreference;
+        bool fallback;
+    } requests[] = {
+        {WGPUPowerPreference_HighPerformance, false},
+        {WGPUPowerPreference_LowPower, false},
+        {WGPUPowerPreference_Undefined, true}
+    };
+
+    for (const auto& r : requests) {
+        WGPUAdapter adapter = request_adapter(instance,r.powerPreference,r.fallback);
+        if (!adapter) {
+            continue;
+        }
+
+        WGPUAdapterInfo info = {};
+        if (wgpuAdapterGetInfo(adapter,&info) != WGPUStatus_Success) {
+            wgpuAdapterRelease(adapter);
+            continue;
+        }
+        AdapterCandidate candidate = {};
+        candidate.adapter = adapter;
+        candidate.name = std::string(info.device.data,info.device.length);
+        candidate.adapterType = info.adapterType;
+        candidate.backendType = info.backendType;
+        candidate.vendorID = info.vendorID;
+        candidate.deviceID = info.deviceID;
+        wgpuAdapterInfoFreeMembers(info);
+
+        // Every request hands out a new adapter object, even for the same GPU
+        bool duplicate = false;
+        for (const AdapterCandidate& other : candidates) {
+            duplicate |= other.vendorID == candidate.vendorID && other.deviceID == candidate.deviceID &&
+                other.adapterType == candidate.adapterType && other.backendType == candidate.backendType &&
+                other.name == candidate.name;
+        }
+        if (duplicate) {
+            wgpuAdapterRelease(adapter);
+            continue;
+        }
+
+        for (WGPUFeatureName feature : optionalFeatures) {
+            candidate.optionalFeatures += wgpuAdapterHasFeature(adapter,feature) ? 1 : 0;
+        }
+        WGPULimits limits = {};
+        if (wgpuAdapterGetLimits(adapter,&limits) == WGPUStatus_Success) {
+            candidate.maxStorageBufferBindingSize = limits.maxStorageBufferBindingSize;
+        }
+        candidates.push_back(candidate);
+    }
+    return candidates;
+}
+
+static int adapter_score(const AdapterCandidate* candidate, const RenderOptions* options) {
+    int score = 0;
+    switch (candidate->adapterType) {
+        case WGPUAdapterType_DiscreteGPU: score = options->lowPower ? 200 : 300; break;
+        case WGPUAdapterType_IntegratedGPU: score = options->lowPower ? 300 : 200; break;
+        case WGPUAdapterType_CPU: score = options->softwareAdapter ? 1000 : 100; break;
+        default: score = 50; break;
+    }
+    score += 10 * candidate->optionalFeatures;
+    if (candidate->maxStorageBufferBindingSize > DEFAULT_STORAGE_BINDING_SIZE) {
+        score += 5;
+    }
+    return score;
+}
+
+WGPUAdapter adapter_select(std::vector<AdapterCandidate>* candidates, const RenderOptions* options) {
+    AdapterCandidate* best = nullptr;
+    for (AdapterCandidate& candidate : *candidates) {
+        candidate.score = adapter_score(&candidate,options);
+        if (!best || candidate.score > best->score) {
+            best = &candidate;
+        }
+    }
+
+    printf("Adapters (%s):\n", webgpu_backend_name());
+    for (const AdapterCandidate& candidate : *candidates) {
+        printf("  %c %4d  %s (%s, %s), %u/%zu optional features, %llu MB storage bindings\n",
+            &candidate == best ? '*' : ' ', candidate.score, candidate.name.c_str(),
+            adapter_type_name(candidate.adapterType), backend_type_name(candidate.backendType),
+            candidate.optionalFeatures, sizeof(optionalFeatures) / sizeof(optionalFeatures[0]),
+            (unsigned long long)(candidate.maxStorageBufferBindingSize >> 20));
+    }
+
+    WGPUAdapter adapter = best ? best->adapter : nullptr;
+    for (AdapterCandidate& candidate : *candidates) {
+        if (candidate.adapter != adapter) {
+            wgpuAdapterRelease(candidate.adapter);
+        }
+        candidate.adapter = nullptr;
+    }
+    return adapter;
+}
+
+void adapter_print_info(WGPUAdapter adapter) {
+    WGPUAdapterInfo info = {};
+    WGPUStatus s = wgpuAdapterGetInfo(adapter,&info);
+    if (s != WGPUStatus_Success) {
+        fprintf(stderr, "wgpuAdapterGetInfo failed (status %d)\n", (int)s);
+        return;
+    }
+    printf("VendorID: %x\n", info.vendorID);
+    printf("Vendor: %.*s\n", (int)info.vendor.length, info.vendor.data);
+    printf("Architecture: %.*s\n", (int)info.architecture.length, info.architecture.data);
+    printf("DeviceID: %x\n", info.deviceID);
+    printf("Name: %.*s\n", (int)info.device.length, info.device.data);
+    printf("Type: %s, backend %s\n", adapter_type_name(info.adapterType), backend_type_name(info.backendType));
+    printf("Driver description: %.*s\n", (int)info.description.length, info.description.data);
+    wgpuAdapterInfoFreeMembers(info);
+}
+
+void device_requirements(WGPUAdapter adapter, std::vector<WGPUFeatureName>* features, WGPULimits* limits) {
+    features->clear();
+    for (WGPUFeatureName feature : optionalFeatures) {
+        if (wgpuAdapterHasFeature(adapter,feature)) {
+            features->push_back(feature);
+        }
+    }
+
+    // Everything the adapter supports is a valid request. Without this the
+    // device gets the spec defaults, e.g. 128 MB storage buffer bindings.
+    *limits = {};
+    if (wgpuAdapterGetLimits(adapter,limits) != WGPUStatus_Success) {
+        fprintf(stderr,"wgpuAdapterGetLimits failed, the device gets the default limits\n");
+    }
+    limits->nextInChain = nullptr;
+}
+
+void device_capabilities_query(WGPUDevice device, DeviceCapabilities* caps) {
+    *caps = {};
+    caps->timestampQuery = wgpuDeviceHasFeature(device,WGPUFeatureName_TimestampQuery);
+    caps->indirectFirstInstance = wgpuDeviceHasFeature(device,WGPUFeatureName_IndirectFirstInstance);
+    caps->textureCompressionBC = wgpuDeviceHasFeature(device,WGPUFeatureName_TextureCompressionBC);
+    caps->textureCompressionETC2 = wgpuDeviceHasFeature(device,WGPUFeatureName_TextureCompressionETC2);
+    wgpuDeviceGetLimits(device,&caps->limits);
+}
+
+void device_capabilities_print(const DeviceCapabilities* caps) {
+    printf("Device features: timestamp query %s, indirect-first-instance %s, BC %s, ETC2 %s\n",
+        caps->timestampQuery ? "yes" : "no", caps->indirectFirstInstance ? "yes" : "no",
+        caps->textureCompressionBC ? "yes" : "no", caps->textureCompressionETC2 ? "yes" : "no");
+    printf("Device limits: %llu MB storage bindings, %llu MB buffers, %u texture array layers\n",
+        (unsigned long long)(caps->limits.maxStorageBufferBindingSize >> 20),
+        (unsigned long long)(caps->limits.maxBufferSize >> 20), caps->limits.maxTextureArrayLayers);
+}
@@ -0,0 +1,57 @@
+#ifndef SIMPLE_WEBGPU_ADAPTER_SELECTION_H
+#define SIMPLE_WEBGPU_ADAPTER_SELECTION_H
+
+#include <string>
+#include <vector>
+#include <webgpu/webgpu.h>
+#include "render_options.h"
+
+// One adapter the instance offered, with what it was scored on
+typedef struct AdapterCandidate {
+    WGPUAdapter adapter;
+    std::string name;
+    WGPUAdapterType adapterType;
+    WGPUBackendType backendType;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t optionalFeatures; // how many of the features we'd request it has
+    uint64_t maxStorageBufferBindingSize;
+    int score;
+} AdapterCandidate;
+
+// What the device ended up with, for the paths that depend on it
+typedef struct DeviceCapabilities {
+    bool timestampQuery;
+    bool indirectFirstInstance;
+    bool textureCompressionBC;
+    bool textureCompressionETC2;
+    WGPULimits limits;
+} DeviceCapabilities;
+
+// "Dawn" or "wgpu-native", whichever this was built against
+const char* webgpu_backend_name();
+
+// webgpu.h can't list adapters, so this asks for one under each power
+// preference and for the fallback adapter, and drops the duplicates
+std::vector<AdapterCandidate> adapter_enumerate(WGPUInstance instance);
+
+// Score the candidates, print them and return the best one. The others are
+// released. Discrete GPUs win unless options->lowPower prefers integrated
+// ones, options->softwareAdapter puts the CPU adapter first, and the
+// optional features and larger storage buffers break ties. Returns nullptr
+// when there are no candidates.
+WGPUAdapter adapter_select(std::vector<AdapterCandidate>* candidates, const RenderOptions* options);
+
+// Print vendor, name, type and driver
+void adapter_print_info(WGPUAdapter adapter);
+
+// Optional features the adapter has that the device should ask for
+// (timestamp queries, indirect-first-instance, compressed textures) and
+// limits raised to everything the adapter supports, which mostly buys
+// larger storage buffers. features must outlive the device request.
+void device_requirements(WGPUAdapter adapter, std::vector<WGPUFeatureName>* features, WGPULimits* limits);
+
+void device_capabilities_query(WGPUDevice device, DeviceCapabilities* caps);
+void device_capabilities_print(const DeviceCapabilities* caps);
+
+#endif // SIMPLE_WEBGPU_ADAPTER_SELECTION_H
@@ -0,0 +1,109 @@
+#include <cstdio>
+#include <iterator>
+#include "bind_group_cache.h"
+
+void bind_group_cache_init(BindGroupCache* cache, WGPUDevice device) {
+    cache->device = device;
+    cache->entries.clear();
+    cache->frame = 0;
+    cache->created = 0;
+    cache->hits = 0;
+    cache->released = 0;
+}
+
+// FNV-1a over the fields that decide what the bind group holds
+static void hash_value(uint64_t* hash, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        *hash ^= (value >> (i * 8)) & 0xff;
+        *hash *= 1099511628211ull;
+    }
+}
+
+uint64_t bind_group_cache_hash(const WGPUBindGroupDescriptor* descriptor) {
+    uint64_t hash = 14695981039346656037ull;
+    hash_value(&hash,(uint64_t)(uintptr_t)descriptor->layout);
+    for (size_t i = 0; i < descriptor->entryCount; i++) {
+        const WGPUBindGroupEntry* entry = &descriptor->entries[i];
+        hash_value(&hash,entry->binding);
+        hash_value(&hash,(uint64_t)(uintptr_t)entry->buffer);
+        hash_value(&hash,entry->offset);
+        hash_value(&hash,entry->size);
+        hash_value(&hash,(uint64_t)(uintptr_t)entry->sampler);
+        hash_value(&hash,(uint64_t)(uintptr_t)entry->textureView);
+    }
+    return hash;
+}
+
+bool bind_group_cache_matches(const BindGroupCacheEntry* cached, const WGPUBindGroupDescriptor* descriptor) {
+    if (cached->layout != descriptor->layout || cached->entries.size() != descriptor->entryCount) {
+        return false;
+    }
+    for (size_t i = 0; i < descriptor->entryCount; i++) {
+        const WGPUBindGroupEntry* a = &cached->entries[i];
+        const WGPUBindGroupEntry* b = &descriptor->entries[i];
+        if (a->binding != b->binding || a->buffer != b->buffer || a->offset != b->offset || a->size != b->size ||
+            a->sampler != b->sampler || a->textureView != b->textureView) {
+            return false;
+        }
+    }
+    return true;
+}
+
+WGPUBindGroup bind_group_cache_get(BindGroupCache* cache, const WGPUBindGroupDescriptor* descriptor) {
+    // The cached bind group holds references to everything in it, so none of
+    // these pointers can be freed and handed out again while it is cached
+    std::vector<BindGroupCacheEntry>& bucket = cache->entries[bind_group_cache_hash(descriptor)];
+    for (BindGroupCacheEntry& entry : bucket) {
+        if (bind_group_cache_matches(&entry,descriptor)) {
+            entry.lastUsedFrame = cache->frame;
+            cache->hits++;
+            return entry.bindGroup;
+        }
+    }
+
+    BindGroupCacheEntry entry;
+    entry.layout = descriptor->layout;
+    entry.entries.assign(descriptor->entries,descriptor->entries + descriptor->entryCount);
+    entry.bindGroup = wgpuDeviceCreateBindGroup(cache->device,descriptor);
+    entry.lastUsedFrame = cache->frame;
+    bucket.push_back(entry);
+    cache->created++;
+    return entry.bindGroup;
+}
+
+void bind_group_cache_end_frame(BindGroupCache* cache) {
+    for (auto it = cache->entries.begin(); it != cache->entries.end();) {
+        std::vector<BindGroupCacheEntry>& bucket = it->second;
+        for (size_t i = 0; i < bucket.size();) {
+            if (cache->frame - bucket[i].lastUsedFrame >= BIND_GROUP_CACHE_MAX_AGE) {
+                // Frames already submitted keep their own reference
+                wgpuBindGroupRelease(bucket[i].bindGroup);
+                bucket[i] = bucket.back();
+                bucket.pop_back();
+                cache->released++;
+            } else {
+                i++;
+            }
+        }
+        it = bucket.empty() ? cache->entries.erase(it) : std::next(it);
+    }
+    cache->frame++;
+}
+
+void bind_group_cache_report(const BindGroupCache* cache) {
+    size_t cached = 0;
+    for (const auto& bucket : cache->entries) {
+        cached += bucket.second.size();
+    }
+    printf("Bind group cache: %zu cached, %u created, %u cache hits, %u released unused\n",
+        cached, cache->created, cache->hits, cache->released);
+}
+
+void bind_group_cache_release(BindGroupCache* cache) {
+    for (auto& bucket : cache->entries) {
+        for (BindGroupCacheEntry& entry : bucket.second) {
+            wgpuBindGroupRelease(entry.bindGroup);
+        }
+    }
+    cache->entries.clear();
+}
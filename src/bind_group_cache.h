@@ -0,0 +1,53 @@
+#ifndef SIMPLE_WEBGPU_BIND_GROUP_CACHE_H
+#define SIMPLE_WEBGPU_BIND_GROUP_CACHE_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <webgpu/webgpu.h>
+
+// Bind groups not asked for in this many frames are released. The renderer
+// asks for every bind group it uses each frame, so anything older holds a
+// view that was replaced, and keeping it would keep a streamed texture's
+// GPU memory alive after the streamer has freed it.
+#define BIND_GROUP_CACHE_MAX_AGE 1
+
+// What a bind group is made of, compared on a hash collision
+typedef struct BindGroupCacheEntry {
+    WGPUBindGroupLayout layout;
+    std::vector<WGPUBindGroupEntry> entries;
+    WGPUBindGroup bindGroup;
+    uint64_t lastUsedFrame;
+} BindGroupCacheEntry;
+
+// Bind groups keyed by a hash of their layout and entries (buffers, ranges,
+// texture views, samplers), so asking for the same contents again returns
+// the bind group made the first time
+typedef struct BindGroupCache {
+    WGPUDevice device;
+    std::unordered_map<uint64_t, std::vector<BindGroupCacheEntry>> entries;
+    uint64_t frame;
+
+    uint32_t created;
+    uint32_t hits;
+    uint32_t released;
+} BindGroupCache;
+
+void bind_group_cache_init(BindGroupCache* cache, WGPUDevice device);
+
+// Returns a bind group owned by the cache, valid at least until the next
+// bind_group_cache_end_frame(). The label is only used when creating it.
+WGPUBindGroup bind_group_cache_get(BindGroupCache* cache, const WGPUBindGroupDescriptor* descriptor);
+
+// Release what hasn't been asked for in BIND_GROUP_CACHE_MAX_AGE frames.
+// Call it after asking for all of this frame's bind groups.
+void bind_group_cache_end_frame(BindGroupCache* cache);
+
+// What the cache is keyed by, and the comparison that settles a collision
+uint64_t bind_group_cache_hash(const WGPUBindGroupDescriptor* descriptor);
+bool bind_group_cache_matches(const BindGroupCacheEntry* cached, const WGPUBindGroupDescriptor* descriptor);
+
+void bind_group_cache_report(const BindGroupCache* cache);
+void bind_group_cache_release(BindGroupCache* cache);
+
+#endif // SIMPLE_WEBGPU_BIND_GROUP_CACHE_H
@@ -0,0 +1,97 @@
+// Expects transform.wgsl to be prepended (provides to_view())
+
+// Must match CLUSTER_MAX_LIGHTS in clustered_lighting.h
+const CLUSTER_MAX_LIGHTS = 128u;
+// Lights loaded into workgroup memory at a time, one per invocation
+const LIGHT_TILE = 64u;
+
+// Must match LightData in clustered_lighting.h
+struct Light {
+	position: vec4f,  // xyz, w range
+	color: vec4f,
+	direction: vec4f, // spot axis, w cos of the cone angle (-1 for point lights)
+	motion: vec4f,    // orbit radius, angular speed, phase
+};
+
+// Must match ClusterParams in clustered_lighting.h
+struct ClusterParams {
+	gridSize: vec3u,
+	lightCount: u32,
+	screenSize: vec2f,
+	time: f32,
+	indexCapacity: u32,
+};
+
+@group(0) @binding(0) var<uniform> params: ClusterParams;
+@group(0) @binding(1) var<storage, read> lightSources: array<Light>;
+@group(0) @binding(2) var<storage, read_write> lights: array<Light>;
+// Per cluster: where its lights start in lightIndices and how many there are
+@group(0) @binding(3) var<storage, read_write> clusters: array<vec2u>;
+@group(0) @binding(4) var<storage, read_write> lightIndices: array<u32>;
+@group(0) @binding(5) var<storage, read_write> indexCounter: atomic<u32>;
+
+// Every light circles around where it was created
+@compute @workgroup_size(64)
+fn animate_lights(@builtin(global_invocation_id) id: vec3u) {
+	if (id.x >= params.lightCount) {
+		return;
+	}
+	var light = lightSources[id.x];
+	let angle = light.motion.z + light.motion.y * params.time;
+	let offset = light.motion.x * vec3f(cos(angle), 0.0, sin(angle));
+	light.position = vec4f(light.position.xyz + offset, light.position.w);
+	lights[id.x] = light;
+}
+
+var<workgroup> tile: array<vec4f, LIGHT_TILE>;
+
+// One invocation per cluster. Tests every light's sphere against the
+// cluster's view-space box and appends the hits to the shared index list.
+@compute @workgroup_size(64)
+fn bin_lights(@builtin(global_invocation_id) id: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	let grid = params.gridSize;
+	let cluster = id.x;
+	let cell = vec3u(cluster % grid.x, (cluster / grid.x) % grid.y, cluster / (grid.x * grid.y));
+
+	// x left to right and y top to bottom like framebuffer coordinates, z
+	// from the near plane. Undo project() to get back to view space.
+	let cellSize = 1.0 / vec3f(grid);
+	let lo = vec3f(cell) * cellSize;
+	let hi = lo + cellSize;
+	let boundsMin = vec3f(lo.x * 2.0 - 1.0, (1.0 - hi.y * 2.0) / ASPECT, lo.z * 2.0 - 1.0);
+	let boundsMax = vec3f(hi.x * 2.0 - 1.0, (1.0 - lo.y * 2.0) / ASPECT, hi.z * 2.0 - 1.0);
+
+	var visible: array<u32, CLUSTER_MAX_LIGHTS>;
+	var count = 0u;
+	for (var base = 0u; base < params.lightCount; base += LIGHT_TILE) {
+		workgroupBarrier();
+		if (base + localIndex < params.lightCount) {
+			let light = lights[base + localIndex];
+			tile[localIndex] = vec4f(to_view(light.position.xyz), light.position.w);
+		}
+		workgroupBarrier();
+
+		let tileCount = min(LIGHT_TILE, params.lightCount - base);
+		for (var i = 0u; i < tileCount; i++) {
+			let sphere = tile[i];
+			let toBox = sphere.xyz - clamp(sphere.xyz, boundsMin, boundsMax);
+			if (dot(toBox, toBox) <= sphere.w * sphere.w && count < CLUSTER_MAX_LIGHTS) {
+				visible[count] = base + i;
+				count++;
+			}
+		}
+	}
+
+	// Past the last cluster, only here to help load the tiles
+	if (cluster >= grid.x * grid.y * grid.z) {
+		return;
+	}
+
+	// Lights that don't fit the index list any more are dropped
+	let offset = atomicAdd(&indexCounter, count);
+	let stored = select(0u, min(count, params.indexCapacity - offset), offset < params.indexCapacity);
+	for (var i = 0u; i < stored; i++) {
+		lightIndices[offset + i] = visible[i];
+	}
+	clusters[cluster] = vec2u(offset, stored);
+}
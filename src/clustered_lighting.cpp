@@ -0,0 +1,157 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "clustered_lighting.h"
+#include "webgpu_utils.h"
+#include "gpu_resources.h"
+
+#define INDEX_CAPACITY (CLUSTER_COUNT * CLUSTER_AVERAGE_LIGHTS)
+
+bool clustered_lighting_create(ClusteredLighting* lighting, WGPUDevice device, const LightData* lights, uint32_t lightCount,
+                               uint32_t width, uint32_t height, const TransformConstants* transform) {
+    *lighting = {};
+    lighting->lightCount = lightCount;
+    lighting->lightCapacity = lightCount;
+    lighting->width = width;
+    lighting->height = height;
+    lighting->binLights = true;
+    lighting->startTime = std::chrono::steady_clock::now();
+
+    // Bindings can't be empty, so without lights there is still one (unused)
+    std::vector<LightData> sources(lights,lights + lightCount);
+    sources.resize(lightCount > 0 ? lightCount : 1);
+    uint64_t lightBytes = sources.size() * sizeof(LightData);
+
+    lighting->paramsBuffer = BufferHandle(create_empty_buffer(device,"Cluster params",
+        WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst,sizeof(ClusterParams)));
+    lighting->lightSourceBuffer = BufferHandle(create_buffer_with_data(device,"Light sources",
+        WGPUBufferUsage_Storage,sources.data(),lightBytes));
+    lighting->lightBuffer = BufferHandle(create_empty_buffer(device,"Lights",
+        WGPUBufferUsage_Storage,lightBytes));
+    lighting->clusterBuffer = BufferHandle(create_empty_buffer(device,"Light clusters",
+        WGPUBufferUsage_Storage,CLUSTER_COUNT * 2 * sizeof(uint32_t)));
+    lighting->lightIndexBuffer = BufferHandle(create_empty_buffer(device,"Light index list",
+        WGPUBufferUsage_Storage,INDEX_CAPACITY * sizeof(uint32_t)));
+    lighting->counterBuffer = BufferHandle(create_empty_buffer(device,"Light index counter",
+        WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst,sizeof(uint32_t)));
+    if (!lighting->paramsBuffer || !lighting->lightSourceBuffer || !lighting->lightBuffer ||
+        !lighting->clusterBuffer || !lighting->lightIndexBuffer || !lighting->counterBuffer) {
+        return false;
+    }
+
+    // Animating and binning
+    std::string source = LoadWGSLShader("src/transform.wgsl") + LoadWGSLShader("src/cluster_lights.wgsl");
+    WGPUShaderModule module = create_shader_module(device,source,"Cluster lights shader");
+
+    WGPUBindGroupLayoutEntry computeLayoutEntries[6] = {
+        buffer_layout_entry(0,WGPUShaderStage_Compute,WGPUBufferBindingType_Uniform),
+        buffer_layout_entry(1,WGPUShaderStage_Compute,WGPUBufferBindingType_ReadOnlyStorage),
+        buffer_layout_entry(2,WGPUShaderStage_Compute,WGPUBufferBindingType_Storage),
+        buffer_layout_entry(3,WGPUShaderStage_Compute,WGPUBufferBindingType_Storage),
+        buffer_layout_entry(4,WGPUShaderStage_Compute,WGPUBufferBindingType_Storage),
+        buffer_layout_entry(5,WGPUShaderStage_Compute,WGPUBufferBindingType_Storage)
+    };
+    WGPUBindGroupLayoutDescriptor computeLayoutDesc = {};
+    computeLayoutDesc.label = {"Cluster lights layout",WGPU_STRLEN};
+    computeLayoutDesc.entryCount = 6;
+    computeLayoutDesc.entries = computeLayoutEntries;
+    WGPUBindGroupLayout computeLayout = wgpuDeviceCreateBindGroupLayout(device,&computeLayoutDesc);
+
+    // bin_lights goes back to view space through to_view() and ASPECT, which
+    // are the first two transform constants. animate_lights uses none.
+    WGPUConstantEntry transformConstants[TRANSFORM_CONSTANT_COUNT];
+    transform_constant_entries(transform,transformConstants);
+    lighting->animatePipeline = ComputePipelineHandle(create_compute_pipeline(device,computeLayout,module,"animate_lights"));
+    lighting->binPipeline = ComputePipelineHandle(create_compute_pipeline(device,computeLayout,module,"bin_lights",2,transformConstants));
+
+    WGPUBindGroupEntry computeEntries[6] = {
+        buffer_entry(0,lighting->paramsBuffer),
+        buffer_entry(1,lighting->lightSourceBuffer),
+        buffer_entry(2,lighting->lightBuffer),
+        buffer_entry(3,lighting->clusterBuffer),
+        buffer_entry(4,lighting->lightIndexBuffer),
+        buffer_entry(5,lighting->counterBuffer)
+    };
+    WGPUBindGroupDescriptor computeDesc = {};
+    computeDesc.label = {"Cluster lights bind group",WGPU_STRLEN};
+    computeDesc.layout = computeLayout;
+    computeDesc.entryCount = 6;
+    computeDesc.entries = computeEntries;
+    lighting->computeBindGroup = BindGroupHandle(wgpuDeviceCreateBindGroup(device,&computeDesc));
+    wgpuBindGroupLayoutRelease(computeLayout);
+    wgpuShaderModuleRelease(module);
+
+    // What fs_main reads
+    WGPUBindGroupLayoutEntry renderLayoutEntries[4] = {
+        buffer_layout_entry(0,WGPUShaderStage_Fragment,WGPUBufferBindingType_Uniform),
+        buffer_layout_entry(1,WGPUShaderStage_Fragment,WGPUBufferBindingType_ReadOnlyStorage),
+        buffer_layout_entry(2,WGPUShaderStage_Fragment,WGPUBufferBindingType_ReadOnlyStorage),
+        buffer_layout_entry(3,WGPUShaderStage_Fragment,WGPUBufferBindingType_ReadOnlyStorage)
+    };
+    WGPUBindGroupLayoutDescriptor renderLayoutDesc = {};
+    renderLayoutDesc.label = {"Scene lights layout",WGPU_STRLEN};
+    renderLayoutDesc.entryCount = 4;
+    renderLayoutDesc.entries = renderLayoutEntries;
+    lighting->renderLayout = BindGroupLayoutHandle(wgpuDeviceCreateBindGroupLayout(device,&renderLayoutDesc));
+
+    WGPUBindGroupEntry renderEntries[4] = {
+        buffer_entry(0,lighting->paramsBuffer),
+        buffer_entry(1,lighting->lightBuffer),
+        buffer_entry(2,lighting->clusterBuffer),
+        buffer_entry(3,lighting->lightIndexBuffer)
+    };
+    WGPUBindGroupDescriptor renderDesc = {};
+    renderDesc.label = {"Scene lights bind group",WGPU_STRLEN};
+    renderDesc.layout = lighting->renderLayout;
+    renderDesc.entryCount = 4;
+    renderDesc.entries = renderEntries;
+    lighting->renderBindGroup = BindGroupHandle(wgpuDeviceCreateBindGroup(device,&renderDesc));
+
+    printf("Clustered lighting: %u lights, %ux%ux%u clusters, room for %u light indices\n",
+        lightCount, CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, INDEX_CAPACITY);
+    return true;
+}
+
+void clustered_lighting_set_light_count(ClusteredLighting* lighting, uint32_t lightCount) {
+    lighting->lightCount = lightCount < lighting->lightCapacity ? lightCount : lighting->lightCapacity;
+}
+
+void clustered_lighting_begin_frame(ClusteredLighting* lighting, WGPUQueue queue) {
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - lighting->startTime;
+    ClusterParams params = {
+        {CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z},
+        lighting->lightCount,
+        {(float)lighting->width, (float)lighting->height},
+        elapsed.count(),
+        INDEX_CAPACITY
+    };
+    wgpuQueueWriteBuffer(queue,lighting->paramsBuffer,0,&params,sizeof(params));
+}
+
+void clustered_lighting_encode(ClusteredLighting* lighting, WGPUCommandEncoder encoder) {
+    if (lighting->lightCount == 0) {
+        return;
+    }
+    wgpuCommandEncoderClearBuffer(encoder,lighting->counterBuffer,0,sizeof(uint32_t));
+
+    WGPUComputePassDescriptor passDesc = {};
+    passDesc.label = {"Light cluster pass",WGPU_STRLEN};
+    WGPUComputePassEncoder pass = wgpuCommandEncoderBeginComputePass(encoder,&passDesc);
+    wgpuComputePassEncoderSetBindGroup(pass,0,lighting->computeBindGroup,0,nullptr);
+
+    wgpuComputePassEncoderSetPipeline(pass,lighting->animatePipeline);
+    wgpuComputePassEncoderDispatchWorkgroups(pass,workgroup_count(lighting->lightCount,64),1,1);
+
+    if (lighting->binLights) {
+        wgpuComputePassEncoderSetPipeline(pass,lighting->binPipeline);
+        wgpuComputePassEncoderDispatchWorkgroups(pass,workgroup_count(CLUSTER_COUNT,64),1,1);
+    }
+
+    wgpuComputePassEncoderEnd(pass);
+    wgpuComputePassEncoderRelease(pass);
+}
+
+void clustered_lighting_release(ClusteredLighting* lighting) {
+    *lighting = {};
+}
@@ -0,0 +1,79 @@
+#ifndef SIMPLE_WEBGPU_CLUSTERED_LIGHTING_H
+#define SIMPLE_WEBGPU_CLUSTERED_LIGHTING_H
+
+#include <chrono>
+#include <cstdint>
+#include <webgpu/webgpu.h>
+#include "gpu_resources.h"
+#include "shader_variants.h"
+
+// Clusters across the screen and through the depth range. project() is
+// orthographic, so the depth slices are evenly spaced rather than exponential.
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 8
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+
+// Lights one cluster can list. Must match CLUSTER_MAX_LIGHTS in cluster_lights.wgsl
+#define CLUSTER_MAX_LIGHTS 128
+// The shared index list has room for this many lights per cluster on average
+#define CLUSTER_AVERAGE_LIGHTS 64
+
+// One point or spot light. Must match Light in cluster_lights.wgsl/simple_shader.wgsl
+typedef struct LightData {
+    float position[4];  // xyz, w range
+    float color[4];     // rgb, w unused
+    float direction[4]; // spot axis in xyz, w cos of the cone angle (-1 for point lights)
+    float motion[4];    // orbit radius, angular speed, phase, unused
+} LightData;
+
+// Must match ClusterParams in cluster_lights.wgsl/simple_shader.wgsl
+typedef struct ClusterParams {
+    uint32_t gridSize[3];
+    uint32_t lightCount;
+    float screenSize[2];
+    float time;           // seconds, drives the light motion
+    uint32_t indexCapacity;
+} ClusterParams;
+
+typedef struct ClusteredLighting {
+    uint32_t lightCount;    // lights in use, at most lightCapacity
+    uint32_t lightCapacity;
+    uint32_t width;
+    uint32_t height;
+    // Bin the lights into clusters. Off when fs_main loops over every light.
+    bool binLights;
+    std::chrono::steady_clock::time_point startTime;
+
+    BufferHandle paramsBuffer;
+    BufferHandle lightSourceBuffer; // lights as created, before they move
+    BufferHandle lightBuffer;       // where they are this frame
+    BufferHandle clusterBuffer;     // (offset, count) into lightIndexBuffer per cluster
+    BufferHandle lightIndexBuffer;
+    BufferHandle counterBuffer;     // indices handed out so far this frame
+
+    ComputePipelineHandle animatePipeline;
+    ComputePipelineHandle binPipeline;
+    BindGroupHandle computeBindGroup;
+    BindGroupLayoutHandle renderLayout; // group 1 of the scene pipelines
+    BindGroupHandle renderBindGroup;
+} ClusteredLighting;
+
+// transform has to match what the scene pipelines are specialized with.
+// Returns false when the GPU memory budget doesn't leave room for it.
+bool clustered_lighting_create(ClusteredLighting* lighting, WGPUDevice device, const LightData* lights, uint32_t lightCount,
+                               uint32_t width, uint32_t height, const TransformConstants* transform);
+
+// Use only the first lightCount lights (clamped to the capacity)
+void clustered_lighting_set_light_count(ClusteredLighting* lighting, uint32_t lightCount);
+
+// Upload this frame's parameters. Call once per frame before submitting.
+void clustered_lighting_begin_frame(ClusteredLighting* lighting, WGPUQueue queue);
+
+// Move the lights and, with binLights, build the cluster lists. Must come
+// before the render passes that shade with them.
+void clustered_lighting_encode(ClusteredLighting* lighting, WGPUCommandEncoder encoder);
+
+void clustered_lighting_release(ClusteredLighting* lighting);
+
+#endif // SIMPLE_WEBGPU_CLUSTERED_LIGHTING_H
@@ -0,0 +1,90 @@
+#include <cstdio>
+#include "frame_stats.h"
+#include "gpu_resources.h"
+
+#define QUERY_BUFFER_SIZE (FRAME_STATS_MAX_QUERIES * sizeof(uint64_t))
+
+bool frame_stats_create(FrameStats* stats, WGPUDevice device) {
+    *stats = {};
+
+    WGPUQuerySetDescriptor querySetDesc = {};
+    querySetDesc.label = {"Shaded sample queries",WGPU_STRLEN};
+    querySetDesc.type = WGPUQueryType_Occlusion;
+    querySetDesc.count = FRAME_STATS_MAX_QUERIES;
+    stats->occlusionQuerySet = QuerySetHandle(wgpuDeviceCreateQuerySet(device,&querySetDesc));
+
+    WGPUBufferDescriptor bufferDesc = {};
+    bufferDesc.nextInChain = nullptr;
+    bufferDesc.size = QUERY_BUFFER_SIZE;
+    bufferDesc.mappedAtCreation = false;
+
+    bufferDesc.label = {"Query resolve buffer",WGPU_STRLEN};
+    bufferDesc.usage = WGPUBufferUsage_QueryResolve | WGPUBufferUsage_CopySrc;
+    stats->resolveBuffer = BufferHandle(tracked_create_buffer(device,&bufferDesc));
+
+    bufferDesc.label = {"Query readback buffer",WGPU_STRLEN};
+    bufferDesc.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
+    stats->readbackBuffer = BufferHandle(tracked_create_buffer(device,&bufferDesc));
+    return stats->resolveBuffer && stats->readbackBuffer;
+}
+
+void frame_stats_begin_frame(FrameStats* stats) {
+    stats->queryCount = 0;
+}
+
+uint32_t frame_stats_next_query(FrameStats* stats) {
+    if (stats->queryCount >= FRAME_STATS_MAX_QUERIES) {
+        return WGPU_QUERY_SET_INDEX_UNDEFINED;
+    }
+    return stats->queryCount++;
+}
+
+void frame_stats_encode_readback(FrameStats* stats, WGPUCommandEncoder encoder) {
+    if (stats->readbackPending || stats->queryCount == 0) {
+        return;
+    }
+    uint64_t size = stats->queryCount * sizeof(uint64_t);
+    wgpuCommandEncoderResolveQuerySet(encoder,stats->occlusionQuerySet,0,stats->queryCount,stats->resolveBuffer,0);
+    wgpuCommandEncoderCopyBufferToBuffer(encoder,stats->resolveBuffer,0,stats->readbackBuffer,0,size);
+    stats->readbackQueryCount = stats->queryCount;
+    stats->readbackEncoded = true;
+}
+
+static void readback_callback(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, void* userdata2) {
+    FrameStats* stats = (FrameStats*)userdata1;
+    stats->readbackPending = false;
+    if (status != WGPUMapAsyncStatus_Success) {
+        fprintf(stderr,"Query readback failed: %.*s\n",(int)message.length,message.data);
+        return;
+    }
+
+    const uint64_t* samples = (const uint64_t*)wgpuBufferGetConstMappedRange(stats->readbackBuffer,0,QUERY_BUFFER_SIZE);
+    uint64_t shaded = 0;
+    for (uint32_t i = 0; i < stats->readbackQueryCount; i++) {
+        shaded += samples[i];
+    }
+    wgpuBufferUnmap(stats->readbackBuffer);
+
+    stats->shadedSamples = shaded;
+    stats->totalShadedSamples += shaded;
+    stats->framesRead++;
+}
+
+void frame_stats_request_readback(FrameStats* stats) {
+    if (!stats->readbackEncoded) {
+        return;
+    }
+    stats->readbackEncoded = false;
+    stats->readbackPending = true;
+
+    WGPUBufferMapCallbackInfo mapInfo = {};
+    mapInfo.nextInChain = nullptr;
+    mapInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+    mapInfo.callback = &readback_callback;
+    mapInfo.userdata1 = stats;
+    wgpuBufferMapAsync(stats->readbackBuffer,WGPUMapMode_Read,0,QUERY_BUFFER_SIZE,mapInfo);
+}
+
+void frame_stats_release(FrameStats* stats) {
+    *stats = {};
+}
@@ -0,0 +1,43 @@
+#ifndef SIMPLE_WEBGPU_FRAME_STATS_H
+#define SIMPLE_WEBGPU_FRAME_STATS_H
+
+#include <cstdint>
+#include <webgpu/webgpu.h>
+#include "gpu_resources.h"
+
+#define FRAME_STATS_MAX_QUERIES 4
+
+// Sums the occlusion query results of the color passes. WebGPU only promises
+// that a result is zero or not. In practice Dawn and wgpu-native report
+// how many samples passed the depth test. That tracks overdraw on one
+// backend, but it counts samples rather than fs_main invocations and isn't
+// comparable across backends.
+// WebGPU has no pipeline statistics queries, so this is the closest we get.
+typedef struct FrameStats {
+    QuerySetHandle occlusionQuerySet;
+    BufferHandle resolveBuffer;
+    BufferHandle readbackBuffer;
+    uint32_t queryCount;         // queries handed out this frame
+    uint32_t readbackQueryCount; // queries in the readback in flight
+    bool readbackEncoded;
+    bool readbackPending;
+
+    uint64_t shadedSamples;      // last frame read back
+    uint64_t totalShadedSamples; // sum over every frame read back
+    uint32_t framesRead;
+} FrameStats;
+
+// Returns false when the GPU memory budget doesn't leave room for it
+bool frame_stats_create(FrameStats* stats, WGPUDevice device);
+void frame_stats_begin_frame(FrameStats* stats);
+
+// Index for wgpuRenderPassEncoderBeginOcclusionQuery
+uint32_t frame_stats_next_query(FrameStats* stats);
+
+// Resolve this frame's queries and map them once the commands are submitted
+void frame_stats_encode_readback(FrameStats* stats, WGPUCommandEncoder encoder);
+void frame_stats_request_readback(FrameStats* stats);
+
+void frame_stats_release(FrameStats* stats);
+
+#endif // SIMPLE_WEBGPU_FRAME_STATS_H
@@ -0,0 +1,199 @@
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "gpu_resources.h"
+
+typedef struct ResourceRecord {
+    ResourceCategory category;
+    uint64_t bytes;
+    std::string label;
+} ResourceRecord;
+
+static const char* categoryNames[RESOURCE_CATEGORY_COUNT] = {"buffers", "textures", "attachments"};
+
+// One registry for the process, the release functions have no other context
+static struct ResourceRegistry {
+    std::mutex mutex;
+    std::unordered_map<const void*, ResourceRecord> live;
+    ResourceSnapshot totals;
+} registry;
+
+static std::string label_string(WGPUStringView label) {
+    if (!label.data) {
+        return "";
+    }
+    return label.length == WGPU_STRLEN ? std::string(label.data) : std::string(label.data,label.length);
+}
+
+void resource_registry_set_budget(uint64_t budgetBytes) {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.totals.budgetBytes = budgetBytes;
+}
+
+static bool fits_budget(uint64_t bytes) {
+    const ResourceSnapshot* totals = &registry.totals;
+    return totals->budgetBytes == 0 || totals->totalBytes + bytes <= totals->budgetBytes;
+}
+
+void resource_registry_snapshot(ResourceSnapshot* snapshot) {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    *snapshot = registry.totals;
+}
+
+void resource_registry_print(const char* prefix) {
+    ResourceSnapshot snapshot;
+    resource_registry_snapshot(&snapshot);
+    printf("%s: %.2f MB live (peak %.2f MB", prefix, snapshot.totalBytes / 1048576.0, snapshot.peakBytes / 1048576.0);
+    if (snapshot.budgetBytes > 0) {
+        printf(", budget %.2f MB", snapshot.budgetBytes / 1048576.0);
+    }
+    printf(")");
+    for (int c = 0; c < RESOURCE_CATEGORY_COUNT; c++) {
+        printf(", %u %s %.2f MB", snapshot.count[c], categoryNames[c], snapshot.bytes[c] / 1048576.0);
+    }
+    if (snapshot.rejected > 0) {
+        printf(", %u allocations refused", snapshot.rejected);
+    }
+    printf("\n");
+}
+
+uint32_t resource_registry_report_leaks() {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const auto& entry : registry.live) {
+        const ResourceRecord& record = entry.second;
+        fprintf(stderr,"Leaked %s \"%s\": %llu bytes\n", categoryNames[record.category],
+            record.label.c_str(), (unsigned long long)record.bytes);
+    }
+    return (uint32_t)registry.live.size();
+}
+
+// Reserve the bytes before creating the resource so two threads can't both
+// squeeze under the budget
+static bool reserve(ResourceCategory category, uint64_t bytes, WGPUStringView label) {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    ResourceSnapshot* totals = &registry.totals;
+    if (!fits_budget(bytes)) {
+        totals->rejected++;
+        fprintf(stderr,"Refusing %llu bytes for \"%s\": %llu of %llu budget bytes in use\n",
+            (unsigned long long)bytes, label_string(label).c_str(),
+            (unsigned long long)totals->totalBytes, (unsigned long long)totals->budgetBytes);
+        return false;
+    }
+    totals->bytes[category] += bytes;
+    totals->count[category]++;
+    totals->totalBytes += bytes;
+    if (totals->totalBytes > totals->peakBytes) {
+        totals->peakBytes = totals->totalBytes;
+    }
+    return true;
+}
+
+static void unreserve(ResourceCategory category, uint64_t bytes) {
+    ResourceSnapshot* totals = &registry.totals;
+    totals->bytes[category] -= bytes;
+    totals->count[category]--;
+    totals->totalBytes -= bytes;
+}
+
+static void record(const void* handle, ResourceCategory category, uint64_t bytes, WGPUStringView label) {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    if (!handle) {
+        unreserve(category,bytes);
+        return;
+    }
+    registry.live[handle] = {category, bytes, label_string(label)};
+}
+
+static void forget(const void* handle) {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto it = registry.live.find(handle);
+    if (it == registry.live.end()) {
+        return;
+    }
+    unreserve(it->second.category,it->second.bytes);
+    registry.live.erase(it);
+}
+
+WGPUBuffer tracked_create_buffer(WGPUDevice device, const WGPUBufferDescriptor* descriptor) {
+    if (!reserve(RESOURCE_CATEGORY_BUFFER,descriptor->size,descriptor->label)) {
+        return nullptr;
+    }
+    WGPUBuffer buffer = wgpuDeviceCreateBuffer(device,descriptor);
+    record(buffer,RESOURCE_CATEGORY_BUFFER,descriptor->size,descriptor->label);
+    return buffer;
+}
+
+WGPUTexture tracked_create_texture(WGPUDevice device, const WGPUTextureDescriptor* descriptor) {
+    ResourceCategory category = (descriptor->usage & WGPUTextureUsage_RenderAttachment) ?
+        RESOURCE_CATEGORY_ATTACHMENT : RESOURCE_CATEGORY_TEXTURE;
+    uint64_t bytes = texture_size_bytes(descriptor);
+    if (!reserve(category,bytes,descriptor->label)) {
+        return nullptr;
+    }
+    WGPUTexture texture = wgpuDeviceCreateTexture(device,descriptor);
+    record(texture,category,bytes,descriptor->label);
+    return texture;
+}
+
+void tracked_release_buffer(WGPUBuffer buffer) {
+    if (!buffer) {
+        return;
+    }
+    forget(buffer);
+    wgpuBufferRelease(buffer);
+}
+
+void tracked_release_texture(WGPUTexture texture) {
+    if (!texture) {
+        return;
+    }
+    forget(texture);
+    wgpuTextureRelease(texture);
+}
+
+uint32_t texture_format_block_bytes(WGPUTextureFormat format, uint32_t* blockSize) {
+    *blockSize = 1;
+    switch (format) {
+        case WGPUTextureFormat_RGBA16Float:
+            return 8;
+        case WGPUTextureFormat_BC1RGBAUnorm:
+        case WGPUTextureFormat_BC1RGBAUnormSrgb:
+        case WGPUTextureFormat_ETC2RGB8Unorm:
+        case WGPUTextureFormat_ETC2RGB8UnormSrgb:
+            *blockSize = 4;
+            return 8;
+        case WGPUTextureFormat_BC3RGBAUnorm:
+        case WGPUTextureFormat_BC3RGBAUnormSrgb:
+        case WGPUTextureFormat_BC7RGBAUnorm:
+        case WGPUTextureFormat_BC7RGBAUnormSrgb:
+        case WGPUTextureFormat_ETC2RGBA8Unorm:
+        case WGPUTextureFormat_ETC2RGBA8UnormSrgb:
+            *blockSize = 4;
+            return 16;
+        default:
+            // R32Float, RGBA8/BGRA8 and the depth formats we use. Drivers
+            // usually store Depth24Plus in 32 bits as well.
+            return 4;
+    }
+}
+
+uint64_t texture_size_bytes(const WGPUTextureDescriptor* descriptor) {
+    uint32_t blockSize;
+    uint32_t blockBytes = texture_format_block_bytes(descriptor->format,&blockSize);
+    uint32_t layers = descriptor->size.depthOrArrayLayers > 0 ? descriptor->size.depthOrArrayLayers : 1;
+    uint32_t samples = descriptor->sampleCount > 0 ? descriptor->sampleCount : 1;
+
+    uint64_t bytes = 0;
+    for (uint32_t level = 0; level < descriptor->mipLevelCount; level++) {
+        uint32_t width = descriptor->size.width >> level;
+        uint32_t height = descriptor->size.height >> level;
+        width = width > 0 ? width : 1;
+        height = height > 0 ? height : 1;
+        uint64_t blocksWide = (width + blockSize - 1) / blockSize;
+        uint64_t blocksHigh = (height + blockSize - 1) / blockSize;
+        uint64_t levelLayers = descriptor->dimension == WGPUTextureDimension_3D ? ((layers >> level) > 0 ? layers >> level : 1) : layers;
+        bytes += blocksWide * blocksHigh * blockBytes * levelLayers;
+    }
+    return bytes * samples;
+}
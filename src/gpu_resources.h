@@ -0,0 +1,108 @@
+#ifndef SIMPLE_WEBGPU_GPU_RESOURCES_H
+#define SIMPLE_WEBGPU_GPU_RESOURCES_H
+
+#include <cstdint>
+#include <utility>
+#include <webgpu/webgpu.h>
+
+// GPU memory accounting. Buffers and textures made through tracked_create_*
+// are recorded with their size until they are released through the
+// matching tracked_release_*, so the registry always knows how much memory
+// is live, can refuse allocations over a budget and can list what was never
+// released. Safe to call from any thread.
+
+typedef enum ResourceCategory {
+    RESOURCE_CATEGORY_BUFFER = 0,
+    RESOURCE_CATEGORY_TEXTURE,    // sampled or storage textures
+    RESOURCE_CATEGORY_ATTACHMENT, // textures with RenderAttachment usage
+    RESOURCE_CATEGORY_COUNT
+} ResourceCategory;
+
+typedef struct ResourceSnapshot {
+    uint64_t bytes[RESOURCE_CATEGORY_COUNT];
+    uint32_t count[RESOURCE_CATEGORY_COUNT];
+    uint64_t totalBytes;
+    uint64_t peakBytes;
+    uint64_t budgetBytes; // 0 means no budget
+    uint32_t rejected;    // allocations refused because of the budget
+} ResourceSnapshot;
+
+// budgetBytes 0 disables the budget
+void resource_registry_set_budget(uint64_t budgetBytes);
+
+// Copy of the current numbers, cheap enough to poll every frame
+void resource_registry_snapshot(ResourceSnapshot* snapshot);
+void resource_registry_print(const char* prefix);
+
+// List every tracked buffer and texture that is still alive. Returns how
+// many there were. Other WebGPU objects aren't tracked, so a leaked view,
+// bind group or pipeline doesn't show up here.
+uint32_t resource_registry_report_leaks();
+
+// Return nullptr (and count a rejection) when the allocation would go over
+// the budget
+WGPUBuffer tracked_create_buffer(WGPUDevice device, const WGPUBufferDescriptor* descriptor);
+WGPUTexture tracked_create_texture(WGPUDevice device, const WGPUTextureDescriptor* descriptor);
+
+// Accept nullptr
+void tracked_release_buffer(WGPUBuffer buffer);
+void tracked_release_texture(WGPUTexture texture);
+
+// Bytes per 4x4 block for compressed formats (blockSize 4), per texel
+// otherwise (blockSize 1)
+uint32_t texture_format_block_bytes(WGPUTextureFormat format, uint32_t* blockSize);
+
+// Bytes a texture takes up, all mips and layers included
+uint64_t texture_size_bytes(const WGPUTextureDescriptor* descriptor);
+
+// Owns one reference to a WebGPU object and releases it when it goes out of
+// scope. Move-only, so there is never any doubt about who releases what.
+// Converts to the raw handle, so it can be passed straight to wgpu* calls.
+template <typename Handle, void (*Release)(Handle)>
+class GpuHandle {
+public:
+    GpuHandle() : handle(nullptr) {}
+    explicit GpuHandle(Handle raw) : handle(raw) {}
+    ~GpuHandle() { reset(); }
+
+    GpuHandle(const GpuHandle&) = delete;
+    GpuHandle& operator=(const GpuHandle&) = delete;
+
+    GpuHandle(GpuHandle&& other) noexcept : handle(other.release()) {}
+    GpuHandle& operator=(GpuHandle&& other) noexcept {
+        if (this != &other) {
+            reset(other.release());
+        }
+        return *this;
+    }
+
+    Handle get() const { return handle; }
+    operator Handle() const { return handle; }
+    explicit operator bool() const { return handle != nullptr; }
+
+    // Give up ownership without releasing
+    Handle release() { return std::exchange(handle, nullptr); }
+
+    void reset(Handle raw = nullptr) {
+        if (handle) {
+            Release(handle);
+        }
+        handle = raw;
+    }
+
+private:
+    Handle handle;
+};
+
+typedef GpuHandle<WGPUBuffer, tracked_release_buffer> BufferHandle;
+typedef GpuHandle<WGPUTexture, tracked_release_texture> TextureHandle;
+typedef GpuHandle<WGPUTextureView, wgpuTextureViewRelease> TextureViewHandle;
+typedef GpuHandle<WGPUSampler, wgpuSamplerRelease> SamplerHandle;
+typedef GpuHandle<WGPUQuerySet, wgpuQuerySetRelease> QuerySetHandle;
+typedef GpuHandle<WGPUBindGroupLayout, wgpuBindGroupLayoutRelease> BindGroupLayoutHandle;
+typedef GpuHandle<WGPUBindGroup, wgpuBindGroupRelease> BindGroupHandle;
+typedef GpuHandle<WGPUPipelineLayout, wgpuPipelineLayoutRelease> PipelineLayoutHandle;
+typedef GpuHandle<WGPUShaderModule, wgpuShaderModuleRelease> ShaderModuleHandle;
+typedef GpuHandle<WGPUComputePipeline, wgpuComputePipelineRelease> ComputePipelineHandle;
+
+#endif // SIMPLE_WEBGPU_GPU_RESOURCES_H
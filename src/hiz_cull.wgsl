@@ -0,0 +1,143 @@
+// Expects transform.wgsl to be prepended (provides project())
+//
+// Two-phase occlusion culling:
+//  - cull_early runs before anything is drawn and keeps the instances that
+//    were visible last frame (frustum test only)
+//  - once those are drawn, the Hi-Z pyramid is built from their depth and
+//    cull_late tests every instance against it. Instances that became visible
+//    get drawn in a second pass, and the visibility flags feed the next frame.
+
+// Must match InstanceData in hiz_culling.h
+struct Instance {
+    center: vec4f,
+    extent: vec4f,
+    color: vec4f,
+};
+
+// Layout of a DrawIndexedIndirect argument block
+struct DrawArgs {
+    indexCount: u32,
+    instanceCount: atomic<u32>,
+    firstIndex: u32,
+    baseVertex: i32,
+    firstInstance: u32,
+};
+
+struct CullParams {
+    instanceCount: u32,
+    hizWidth: u32,
+    hizHeight: u32,
+    mipCount: u32,
+};
+
+struct CullCounters {
+    occluded: atomic<u32>,
+    frustumCulled: atomic<u32>,
+};
+
+@group(0) @binding(0) var<uniform> params: CullParams;
+@group(0) @binding(1) var<storage, read> instances: array<Instance>;
+@group(0) @binding(2) var<storage, read_write> visibility: array<u32>;
+@group(0) @binding(3) var<storage, read_write> drawArgs: array<DrawArgs, 2>;
+@group(0) @binding(4) var<storage, read_write> earlyList: array<u32>;
+@group(0) @binding(5) var<storage, read_write> lateList: array<u32>;
+@group(0) @binding(6) var<storage, read_write> counters: CullCounters;
+@group(0) @binding(7) var hiz: texture_2d<f32>;
+
+struct Bounds {
+    lo: vec3f,
+    hi: vec3f,
+};
+
+// Screen-space box of the instance (NDC xy, depth z)
+fn screen_bounds(inst: Instance) -> Bounds {
+    var b: Bounds;
+    b.lo = vec3f(1e9);
+    b.hi = vec3f(-1e9);
+    for (var i = 0u; i < 8u; i++) {
+        let corner = vec3f(
+            select(-1.0, 1.0, (i & 1u) != 0u),
+            select(-1.0, 1.0, (i & 2u) != 0u),
+            select(-1.0, 1.0, (i & 4u) != 0u),
+        );
+        let clip = project(inst.center.xyz + corner * inst.extent.xyz);
+        let ndc = clip.xyz / clip.w;
+        b.lo = min(b.lo, ndc);
+        b.hi = max(b.hi, ndc);
+    }
+    return b;
+}
+
+fn in_frustum(b: Bounds) -> bool {
+    return b.hi.x >= -1.0 && b.lo.x <= 1.0 &&
+           b.hi.y >= -1.0 && b.lo.y <= 1.0 &&
+           b.hi.z >= 0.0 && b.lo.z <= 1.0;
+}
+
+fn is_occluded(b: Bounds) -> bool {
+    // Boxes crossing the near plane can't be tested reliably
+    if (select(b.lo.z < 0.0, b.hi.z > 1.0, REVERSE_Z)) {
+        return false;
+    }
+    let nearest = select(b.lo.z, b.hi.z, REVERSE_Z);
+
+    // NDC -> pixels of level 0 (y points down in texture space)
+    let size = vec2f(f32(params.hizWidth), f32(params.hizHeight));
+    let minPx = clamp((vec2f(b.lo.x, -b.hi.y) * 0.5 + 0.5) * size, vec2f(0.0), size);
+    let maxPx = clamp((vec2f(b.hi.x, -b.lo.y) * 0.5 + 0.5) * size, vec2f(0.0), size);
+
+    // Pick the level where the box covers at most 2x2 texels
+    let extent = max(maxPx - minPx, vec2f(1.0));
+    let level = min(u32(ceil(log2(max(extent.x, extent.y)))), params.mipCount - 1u);
+    let levelSize = vec2i(textureDimensions(hiz, level));
+    let scale = f32(1u << level);
+    let texMin = clamp(vec2i(minPx / scale), vec2i(0), levelSize - 1);
+    let texMax = clamp(vec2i(maxPx / scale), vec2i(0), levelSize - 1);
+
+    var farthest = textureLoad(hiz, texMin, i32(level)).r;
+    for (var y = texMin.y; y <= texMax.y; y++) {
+        for (var x = texMin.x; x <= texMax.x; x++) {
+            farthest = farther(farthest, textureLoad(hiz, vec2i(x, y), i32(level)).r);
+        }
+    }
+    return select(nearest > farthest, nearest < farthest, REVERSE_Z);
+}
+
+@compute @workgroup_size(64)
+fn cull_early(@builtin(global_invocation_id) id: vec3u) {
+    let i = id.x;
+    if (i >= params.instanceCount || visibility[i] == 0u) {
+        return;
+    }
+    if (!in_frustum(screen_bounds(instances[i]))) {
+        return;
+    }
+    let slot = atomicAdd(&drawArgs[0].instanceCount, 1u);
+    earlyList[slot] = i;
+}
+
+@compute @workgroup_size(64)
+fn cull_late(@builtin(global_invocation_id) id: vec3u) {
+    let i = id.x;
+    if (i >= params.instanceCount) {
+        return;
+    }
+
+    let b = screen_bounds(instances[i]);
+    var visible = true;
+    if (!in_frustum(b)) {
+        visible = false;
+        atomicAdd(&counters.frustumCulled, 1u);
+    } else if (is_occluded(b)) {
+        visible = false;
+        atomicAdd(&counters.occluded, 1u);
+    }
+
+    // Anything visible now that the early pass skipped still has to be drawn
+    let wasVisible = visibility[i] != 0u;
+    visibility[i] = select(0u, 1u, visible);
+    if (visible && !wasVisible) {
+        let slot = atomicAdd(&drawArgs[1].instanceCount, 1u);
+        lateList[slot] = i;
+    }
+}
@@ -0,0 +1,356 @@
+#include <cstdio>
+#include <string>
+#include "hiz_culling.h"
+#include "webgpu_utils.h"
+#include "gpu_resources.h"
+
+// Must match CullParams in hiz_cull.wgsl
+typedef struct CullParams {
+    uint32_t instanceCount;
+    uint32_t hizWidth;
+    uint32_t hizHeight;
+    uint32_t mipCount;
+} CullParams;
+
+// Readback layout: both indirect blocks followed by the CullCounters struct
+#define READBACK_COUNTERS_OFFSET (2 * DRAW_INDEXED_ARGS_SIZE)
+#define COUNTERS_SIZE (2 * sizeof(uint32_t))
+#define READBACK_SIZE (READBACK_COUNTERS_OFFSET + COUNTERS_SIZE)
+
+static WGPUBindGroupLayoutEntry texture_layout_entry(uint32_t binding, WGPUTextureSampleType sampleType) {
+    WGPUBindGroupLayoutEntry entry = {};
+    setDefault(entry);
+    entry.binding = binding;
+    entry.visibility = WGPUShaderStage_Compute;
+    entry.texture.sampleType = sampleType;
+    entry.texture.viewDimension = WGPUTextureViewDimension_2D;
+    return entry;
+}
+
+static WGPUBindGroupLayoutEntry storage_texture_layout_entry(uint32_t binding) {
+    WGPUBindGroupLayoutEntry entry = {};
+    setDefault(entry);
+    entry.binding = binding;
+    entry.visibility = WGPUShaderStage_Compute;
+    entry.storageTexture.access = WGPUStorageTextureAccess_WriteOnly;
+    entry.storageTexture.format = WGPUTextureFormat_R32Float;
+    entry.storageTexture.viewDimension = WGPUTextureViewDimension_2D;
+    return entry;
+}
+
+static WGPUBindGroupEntry texture_entry(uint32_t binding, WGPUTextureView view) {
+    WGPUBindGroupEntry entry = {};
+    entry.binding = binding;
+    entry.textureView = view;
+    return entry;
+}
+
+static bool create_pyramid(HiZCulling* culling, WGPUDevice device, WGPUTextureView depthTextureView, WGPUShaderModule module) {
+    // hiz_reduce only references REVERSE_Z (through farther())
+    WGPUConstantEntry transformConstants[TRANSFORM_CONSTANT_COUNT];
+    transform_constant_entries(&culling->transform,transformConstants);
+
+    // Level 0 matches the depth buffer, every level after halves it
+    uint32_t largest = culling->width > culling->height ? culling->width : culling->height;
+    uint32_t mipCount = 1;
+    while ((largest >> mipCount) > 0 && mipCount < HIZ_MAX_MIPS) {
+        mipCount++;
+    }
+    culling->mipCount = mipCount;
+
+    WGPUTextureFormat hizFormat = WGPUTextureFormat_R32Float;
+    WGPUTextureDescriptor hizDesc = {};
+    hizDesc.label = {"Hi-Z pyramid",WGPU_STRLEN};
+    hizDesc.dimension = WGPUTextureDimension_2D;
+    hizDesc.format = hizFormat;
+    hizDesc.mipLevelCount = mipCount;
+    hizDesc.sampleCount = 1;
+    hizDesc.size = {culling->width, culling->height, 1};
+    hizDesc.usage = WGPUTextureUsage_StorageBinding | WGPUTextureUsage_TextureBinding;
+    hizDesc.viewFormatCount = 1;
+    hizDesc.viewFormats = &hizFormat;
+    culling->hizTexture = TextureHandle(tracked_create_texture(device,&hizDesc));
+    if (!culling->hizTexture) {
+        return false;
+    }
+
+    WGPUTextureViewDescriptor viewDesc = {};
+    viewDesc.nextInChain = nullptr;
+    viewDesc.format = hizFormat;
+    viewDesc.dimension = WGPUTextureViewDimension_2D;
+    viewDesc.aspect = WGPUTextureAspect_All;
+    viewDesc.baseArrayLayer = 0;
+    viewDesc.arrayLayerCount = 1;
+    viewDesc.baseMipLevel = 0;
+    viewDesc.mipLevelCount = mipCount;
+    culling->hizView = TextureViewHandle(wgpuTextureCreateView(culling->hizTexture,&viewDesc));
+
+    viewDesc.mipLevelCount = 1;
+    for (uint32_t level = 0; level < mipCount; level++) {
+        viewDesc.baseMipLevel = level;
+        culling->hizMipViews[level] = TextureViewHandle(wgpuTextureCreateView(culling->hizTexture,&viewDesc));
+    }
+
+    // Level 0: depth buffer -> R32Float
+    WGPUBindGroupLayoutEntry copyLayoutEntries[2] = {
+        texture_layout_entry(0,WGPUTextureSampleType_Depth),
+        storage_texture_layout_entry(1)
+    };
+    WGPUBindGroupLayoutDescriptor copyLayoutDesc = {};
+    copyLayoutDesc.label = {"Hi-Z copy layout",WGPU_STRLEN};
+    copyLayoutDesc.entryCount = 2;
+    copyLayoutDesc.entries = copyLayoutEntries;
+    WGPUBindGroupLayout copyLayout = wgpuDeviceCreateBindGroupLayout(device,&copyLayoutDesc);
+    culling->copyPipeline = ComputePipelineHandle(create_compute_pipeline(device,copyLayout,module,"hiz_copy"));
+
+    WGPUBindGroupEntry copyEntries[2] = {
+        texture_entry(0,depthTextureView),
+        texture_entry(1,culling->hizMipViews[0])
+    };
+    WGPUBindGroupDescriptor copyDesc = {};
+    copyDesc.label = {"Hi-Z copy bind group",WGPU_STRLEN};
+    copyDesc.layout = copyLayout;
+    copyDesc.entryCount = 2;
+    copyDesc.entries = copyEntries;
+    culling->copyBindGroup = BindGroupHandle(wgpuDeviceCreateBindGroup(device,&copyDesc));
+    wgpuBindGroupLayoutRelease(copyLayout);
+
+    // Levels 1..n: max of the level below
+    WGPUBindGroupLayoutEntry reduceLayoutEntries[2] = {
+        texture_layout_entry(2,WGPUTextureSampleType_UnfilterableFloat),
+        storage_texture_layout_entry(3)
+    };
+    WGPUBindGroupLayoutDescriptor reduceLayoutDesc = {};
+    reduceLayoutDesc.label = {"Hi-Z reduce layout",WGPU_STRLEN};
+    reduceLayoutDesc.entryCount = 2;
+    reduceLayoutDesc.entries = reduceLayoutEntries;
+    WGPUBindGroupLayout reduceLayout = wgpuDeviceCreateBindGroupLayout(device,&reduceLayoutDesc);
+    culling->reducePipeline = ComputePipelineHandle(create_compute_pipeline(device,reduceLayout,module,"hiz_reduce",1,&transformConstants[2]));
+
+    for (uint32_t level = 1; level < mipCount; level++) {
+        WGPUBindGroupEntry reduceEntries[2] = {
+            texture_entry(2,culling->hizMipViews[level - 1]),
+            texture_entry(3,culling->hizMipViews[level])
+        };
+        WGPUBindGroupDescriptor reduceDesc = {};
+        reduceDesc.label = {"Hi-Z reduce bind group",WGPU_STRLEN};
+        reduceDesc.layout = reduceLayout;
+        reduceDesc.entryCount = 2;
+        reduceDesc.entries = reduceEntries;
+        culling->reduceBindGroups[level] = BindGroupHandle(wgpuDeviceCreateBindGroup(device,&reduceDesc));
+    }
+    wgpuBindGroupLayoutRelease(reduceLayout);
+    return true;
+}
+
+bool hiz_culling_create(HiZCulling* culling, WGPUDevice device, WGPUTextureView depthTextureView,
+                        uint32_t width, uint32_t height, uint32_t indexCount,
+                        const InstanceData* instances, uint32_t instanceCount,
+                        const TransformConstants* transform) {
+    *culling = {};
+    culling->instanceCount = instanceCount;
+    culling->transform = *transform;
+    culling->width = width;
+    culling->height = height;
+
+    // Boxes are projected with the same transform the renderer uses, and the
+    // pyramid needs farther() for the depth convention
+    std::string transformSource = LoadWGSLShader("src/transform.wgsl");
+    WGPUShaderModule pyramidModule = create_shader_module(device,transformSource + LoadWGSLShader("src/hiz_pyramid.wgsl"),"Hi-Z pyramid shader");
+    WGPUShaderModule cullModule = create_shader_module(device,transformSource + LoadWGSLShader("src/hiz_cull.wgsl"),"Hi-Z cull shader");
+
+    bool created = create_pyramid(culling,device,depthTextureView,pyramidModule);
+
+    // Buffers
+    CullParams params = {instanceCount, width, height, culling->mipCount};
+    culling->paramsBuffer = BufferHandle(create_buffer_with_data(device,"Cull params",
+        WGPUBufferUsage_Uniform,&params,sizeof(params)));
+
+    culling->instanceBuffer = BufferHandle(create_buffer_with_data(device,"Instance buffer",
+        WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst,instances,instanceCount * sizeof(InstanceData)));
+
+    // Nothing has been seen yet, so the first frame draws everything in the late pass
+    culling->visibilityBuffer = BufferHandle(create_empty_buffer(device,"Visibility buffer",
+        WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst,instanceCount * sizeof(uint32_t)));
+
+    uint32_t drawArgs[10] = {
+        indexCount, 0, 0, 0, 0, // early
+        indexCount, 0, 0, 0, 0  // late
+    };
+    culling->drawArgsBuffer = BufferHandle(create_buffer_with_data(device,"Cull draw args",
+        WGPUBufferUsage_Storage | WGPUBufferUsage_Indirect | WGPUBufferUsage_CopySrc | WGPUBufferUsage_CopyDst,
+        drawArgs,sizeof(drawArgs)));
+
+    culling->earlyListBuffer = BufferHandle(create_empty_buffer(device,"Early visible list",
+        WGPUBufferUsage_Storage,instanceCount * sizeof(uint32_t)));
+    culling->lateListBuffer = BufferHandle(create_empty_buffer(device,"Late visible list",
+        WGPUBufferUsage_Storage,instanceCount * sizeof(uint32_t)));
+    culling->countersBuffer = BufferHandle(create_empty_buffer(device,"Cull counters",
+        WGPUBufferUsage_Storage | WGPUBufferUsage_CopySrc | WGPUBufferUsage_CopyDst,COUNTERS_SIZE));
+    culling->readbackBuffer = BufferHandle(create_empty_buffer(device,"Cull readback",
+        WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst,READBACK_SIZE));
+
+    created = created && culling->paramsBuffer && culling->instanceBuffer && culling->visibilityBuffer &&
+        culling->drawArgsBuffer && culling->earlyListBuffer && culling->lateListBuffer &&
+        culling->countersBuffer && culling->readbackBuffer;
+    if (!created) {
+        wgpuShaderModuleRelease(pyramidModule);
+        wgpuShaderModuleRelease(cullModule);
+        hiz_culling_release(culling);
+        return false;
+    }
+
+    // Culling pipelines
+    WGPUBindGroupLayoutEntry cullLayoutEntries[8] = {
+        buffer_layout_entry(0,WGPUShaderStage_Compute,WGPUBufferBindingType_Uniform),
+        buffer_layout_entry(1,WGPUShaderStage_Compute,WGPUBufferBindingType_ReadOnlyStorage),
+        buffer_layout_entry(2,WGPUShaderStage_Compute,WGPUBufferBindingType_Storage),
+        buffer_layout_entry(3,WGPUShaderStage_Compute,WGPUBufferBindingType_Storage),
+        buffer_layout_entry(4,WGPUShaderStage_Compute,WGPUBufferBindingType_Storage),
+        buffer_layout_entry(5,WGPUShaderStage_Compute,WGPUBufferBindingType_Storage),
+        buffer_layout_entry(6,WGPUShaderStage_Compute,WGPUBufferBindingType_Storage),
+        texture_layout_entry(7,WGPUTextureSampleType_UnfilterableFloat)
+    };
+    WGPUBindGroupLayoutDescriptor cullLayoutDesc = {};
+    cullLayoutDesc.label = {"Cull layout",WGPU_STRLEN};
+    cullLayoutDesc.entryCount = 8;
+    cullLayoutDesc.entries = cullLayoutEntries;
+    WGPUBindGroupLayout cullLayout = wgpuDeviceCreateBindGroupLayout(device,&cullLayoutDesc);
+
+    WGPUConstantEntry transformConstants[TRANSFORM_CONSTANT_COUNT];
+    transform_constant_entries(transform,transformConstants);
+    culling->earlyPipeline = ComputePipelineHandle(create_compute_pipeline(device,cullLayout,cullModule,"cull_early",TRANSFORM_CONSTANT_COUNT,transformConstants));
+    culling->latePipeline = ComputePipelineHandle(create_compute_pipeline(device,cullLayout,cullModule,"cull_late",TRANSFORM_CONSTANT_COUNT,transformConstants));
+
+    WGPUBindGroupEntry cullEntries[8] = {
+        buffer_entry(0,culling->paramsBuffer),
+        buffer_entry(1,culling->instanceBuffer),
+        buffer_entry(2,culling->visibilityBuffer),
+        buffer_entry(3,culling->drawArgsBuffer),
+        buffer_entry(4,culling->earlyListBuffer),
+        buffer_entry(5,culling->lateListBuffer),
+        buffer_entry(6,culling->countersBuffer),
+        texture_entry(7,culling->hizView)
+    };
+    WGPUBindGroupDescriptor cullDesc = {};
+    cullDesc.label = {"Cull bind group",WGPU_STRLEN};
+    cullDesc.layout = cullLayout;
+    cullDesc.entryCount = 8;
+    cullDesc.entries = cullEntries;
+    culling->cullBindGroup = BindGroupHandle(wgpuDeviceCreateBindGroup(device,&cullDesc));
+    wgpuBindGroupLayoutRelease(cullLayout);
+
+    wgpuShaderModuleRelease(pyramidModule);
+    wgpuShaderModuleRelease(cullModule);
+
+    printf("Hi-Z culling: %u instances, %ux%u pyramid with %u levels\n",
+        instanceCount, width, height, culling->mipCount);
+    return true;
+}
+
+void hiz_culling_begin_frame(HiZCulling* culling, WGPUQueue queue) {
+    // Only the instance counts are reset, the rest of the indirect args stays put
+    uint32_t zero = 0;
+    wgpuQueueWriteBuffer(queue,culling->drawArgsBuffer,sizeof(uint32_t),&zero,sizeof(zero));
+    wgpuQueueWriteBuffer(queue,culling->drawArgsBuffer,DRAW_INDEXED_ARGS_SIZE + sizeof(uint32_t),&zero,sizeof(zero));
+
+    uint32_t counters[2] = {0, 0};
+    wgpuQueueWriteBuffer(queue,culling->countersBuffer,0,counters,sizeof(counters));
+}
+
+void hiz_culling_encode_early(HiZCulling* culling, WGPUCommandEncoder encoder) {
+    WGPUComputePassDescriptor passDesc = {};
+    passDesc.label = {"Early cull pass",WGPU_STRLEN};
+    WGPUComputePassEncoder pass = wgpuCommandEncoderBeginComputePass(encoder,&passDesc);
+
+    wgpuComputePassEncoderSetPipeline(pass,culling->earlyPipeline);
+    wgpuComputePassEncoderSetBindGroup(pass,0,culling->cullBindGroup,0,nullptr);
+    wgpuComputePassEncoderDispatchWorkgroups(pass,workgroup_count(culling->instanceCount,64),1,1);
+
+    wgpuComputePassEncoderEnd(pass);
+    wgpuComputePassEncoderRelease(pass);
+}
+
+void hiz_culling_encode_late(HiZCulling* culling, WGPUCommandEncoder encoder) {
+    WGPUComputePassDescriptor passDesc = {};
+    passDesc.label = {"Hi-Z build and late cull pass",WGPU_STRLEN};
+    WGPUComputePassEncoder pass = wgpuCommandEncoderBeginComputePass(encoder,&passDesc);
+
+    // Pyramid, one dispatch per level (8x8 workgroups)
+    wgpuComputePassEncoderSetPipeline(pass,culling->copyPipeline);
+    wgpuComputePassEncoderSetBindGroup(pass,0,culling->copyBindGroup,0,nullptr);
+    wgpuComputePassEncoderDispatchWorkgroups(pass,workgroup_count(culling->width,8),workgroup_count(culling->height,8),1);
+
+    wgpuComputePassEncoderSetPipeline(pass,culling->reducePipeline);
+    for (uint32_t level = 1; level < culling->mipCount; level++) {
+        uint32_t levelWidth = (culling->width >> level) > 0 ? (culling->width >> level) : 1;
+        uint32_t levelHeight = (culling->height >> level) > 0 ? (culling->height >> level) : 1;
+        wgpuComputePassEncoderSetBindGroup(pass,0,culling->reduceBindGroups[level],0,nullptr);
+        wgpuComputePassEncoderDispatchWorkgroups(pass,workgroup_count(levelWidth,8),workgroup_count(levelHeight,8),1);
+    }
+
+    // Test everything against it
+    wgpuComputePassEncoderSetPipeline(pass,culling->latePipeline);
+    wgpuComputePassEncoderSetBindGroup(pass,0,culling->cullBindGroup,0,nullptr);
+    wgpuComputePassEncoderDispatchWorkgroups(pass,workgroup_count(culling->instanceCount,64),1,1);
+
+    wgpuComputePassEncoderEnd(pass);
+    wgpuComputePassEncoderRelease(pass);
+}
+
+void hiz_culling_encode_readback(HiZCulling* culling, WGPUCommandEncoder encoder) {
+    if (culling->readbackPending) {
+        return;
+    }
+    wgpuCommandEncoderCopyBufferToBuffer(encoder,culling->drawArgsBuffer,0,culling->readbackBuffer,0,2 * DRAW_INDEXED_ARGS_SIZE);
+    wgpuCommandEncoderCopyBufferToBuffer(encoder,culling->countersBuffer,0,culling->readbackBuffer,READBACK_COUNTERS_OFFSET,COUNTERS_SIZE);
+    culling->readbackEncoded = true;
+}
+
+static void readback_callback(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, void* userdata2) {
+    HiZCulling* culling = (HiZCulling*)userdata1;
+    culling->readbackPending = false;
+    if (status != WGPUMapAsyncStatus_Success) {
+        fprintf(stderr,"Cull readback failed: %.*s\n",(int)message.length,message.data);
+        return;
+    }
+
+    const uint32_t* data = (const uint32_t*)wgpuBufferGetConstMappedRange(culling->readbackBuffer,0,READBACK_SIZE);
+    CullStats* stats = &culling->stats;
+    stats->earlyDrawn = data[1];
+    stats->lateDrawn = data[DRAW_INDEXED_ARGS_SIZE / sizeof(uint32_t) + 1];
+    stats->occluded = data[READBACK_COUNTERS_OFFSET / sizeof(uint32_t)];
+    stats->frustumCulled = data[READBACK_COUNTERS_OFFSET / sizeof(uint32_t) + 1];
+    stats->frame++;
+    wgpuBufferUnmap(culling->readbackBuffer);
+}
+
+void hiz_culling_report(const HiZCulling* culling) {
+    const CullStats* stats = &culling->stats;
+    if (stats->frame == 0) {
+        return;
+    }
+    uint32_t drawn = stats->earlyDrawn + stats->lateDrawn;
+    printf("Culling: %u/%u instances drawn (early %u, late %u), %u occluded, %u off screen, %u triangles\n",
+        drawn, culling->instanceCount, stats->earlyDrawn, stats->lateDrawn,
+        stats->occluded, stats->frustumCulled, drawn * 12);
+}
+
+void hiz_culling_request_readback(HiZCulling* culling) {
+    if (!culling->readbackEncoded) {
+        return;
+    }
+    culling->readbackEncoded = false;
+    culling->readbackPending = true;
+
+    WGPUBufferMapCallbackInfo mapInfo = {};
+    mapInfo.nextInChain = nullptr;
+    mapInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+    mapInfo.callback = &readback_callback;
+    mapInfo.userdata1 = culling;
+    wgpuBufferMapAsync(culling->readbackBuffer,WGPUMapMode_Read,0,READBACK_SIZE,mapInfo);
+}
+
+void hiz_culling_release(HiZCulling* culling) {
+    *culling = {};
+}
@@ -0,0 +1,92 @@
+#ifndef SIMPLE_WEBGPU_HIZ_CULLING_H
+#define SIMPLE_WEBGPU_HIZ_CULLING_H
+
+#include <cstdint>
+#include <webgpu/webgpu.h>
+#include "gpu_resources.h"
+#include "shader_variants.h"
+
+// Enough levels for a 32768 pixel wide depth buffer
+#define HIZ_MAX_MIPS 16
+
+// One drawable box. Must match Instance in simple_shader.wgsl/hiz_cull.wgsl
+typedef struct InstanceData {
+    float center[4];  // xyz, w unused
+    float extent[4];  // half size along each axis, w unused
+    float color[4];
+} InstanceData;
+
+// What the last finished frame did, read back from the GPU
+typedef struct CullStats {
+    uint32_t earlyDrawn;    // visible last frame, drawn before the pyramid was built
+    uint32_t lateDrawn;     // newly visible, drawn after the late test
+    uint32_t occluded;      // rejected by the Hi-Z test
+    uint32_t frustumCulled; // off screen
+    uint32_t frame;         // how many results have been read back so far
+} CullStats;
+
+typedef struct HiZCulling {
+    uint32_t instanceCount;
+    TransformConstants transform;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipCount;
+
+    BufferHandle paramsBuffer;
+    BufferHandle instanceBuffer;
+    BufferHandle visibilityBuffer; // one u32 flag per instance, carried across frames
+    BufferHandle drawArgsBuffer;   // two DrawIndexedIndirect blocks: [early, late]
+    BufferHandle earlyListBuffer;  // instance ids drawn by the early pass
+    BufferHandle lateListBuffer;   // instance ids drawn by the late pass
+    BufferHandle countersBuffer;
+    BufferHandle readbackBuffer;
+    bool readbackEncoded; // copy recorded this frame, map after submit
+    bool readbackPending; // map in flight, don't touch the buffer
+    CullStats stats;
+
+    TextureHandle hizTexture;
+    TextureViewHandle hizView;                    // all levels, read by cull_late
+    TextureViewHandle hizMipViews[HIZ_MAX_MIPS];  // one per level, for building
+
+    ComputePipelineHandle copyPipeline;
+    ComputePipelineHandle reducePipeline;
+    ComputePipelineHandle earlyPipeline;
+    ComputePipelineHandle latePipeline;
+    BindGroupHandle copyBindGroup;
+    BindGroupHandle reduceBindGroups[HIZ_MAX_MIPS]; // [i] reduces level i-1 into i
+    BindGroupHandle cullBindGroup;
+} HiZCulling;
+
+// Size of one DrawIndexedIndirect argument block
+#define DRAW_INDEXED_ARGS_SIZE (5 * sizeof(uint32_t))
+
+// depthTextureView must come from a texture created with TextureBinding usage.
+// indexCount is the number of indices of the mesh every instance draws.
+// transform has to match what the scene pipelines are specialized with.
+// Returns false when the GPU memory budget doesn't leave room for it.
+bool hiz_culling_create(HiZCulling* culling, WGPUDevice device, WGPUTextureView depthTextureView,
+                        uint32_t width, uint32_t height, uint32_t indexCount,
+                        const InstanceData* instances, uint32_t instanceCount,
+                        const TransformConstants* transform);
+
+// Reset the per-frame counters. Call once per frame before submitting.
+void hiz_culling_begin_frame(HiZCulling* culling, WGPUQueue queue);
+
+// Compute pass selecting the instances the early render pass draws
+void hiz_culling_encode_early(HiZCulling* culling, WGPUCommandEncoder encoder);
+
+// Build the pyramid from the current depth buffer and test every instance
+// against it. Must be encoded after the early render pass.
+void hiz_culling_encode_late(HiZCulling* culling, WGPUCommandEncoder encoder);
+
+// Copy this frame's counts to the readback buffer (skipped while a previous
+// readback is still mapped) and map it once the commands are submitted
+void hiz_culling_encode_readback(HiZCulling* culling, WGPUCommandEncoder encoder);
+void hiz_culling_request_readback(HiZCulling* culling);
+
+// Print the most recent readback, if there has been one
+void hiz_culling_report(const HiZCulling* culling);
+
+void hiz_culling_release(HiZCulling* culling);
+
+#endif // SIMPLE_WEBGPU_HIZ_CULLING_H
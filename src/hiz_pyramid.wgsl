@@ -0,0 +1,45 @@
+// Expects transform.wgsl to be prepended (provides farther())
+//
+// Builds the Hi-Z pyramid: every texel holds the farthest depth of the
+// region it covers, so an object whose nearest point is farther than that is hidden.
+
+@group(0) @binding(0) var depthTex: texture_depth_2d;
+@group(0) @binding(1) var dstMip0: texture_storage_2d<r32float, write>;
+
+@group(0) @binding(2) var srcMip: texture_2d<f32>;
+@group(0) @binding(3) var dstMip: texture_storage_2d<r32float, write>;
+
+// Level 0 is a straight copy of the depth buffer
+@compute @workgroup_size(8, 8)
+fn hiz_copy(@builtin(global_invocation_id) id: vec3u) {
+    let size = textureDimensions(dstMip0);
+    if (id.x >= size.x || id.y >= size.y) {
+        return;
+    }
+    let depth = textureLoad(depthTex, id.xy, 0);
+    textureStore(dstMip0, id.xy, vec4f(depth, 0.0, 0.0, 1.0));
+}
+
+// Every other level takes the max of the 2x2 footprint in the level below
+@compute @workgroup_size(8, 8)
+fn hiz_reduce(@builtin(global_invocation_id) id: vec3u) {
+    let dstSize = textureDimensions(dstMip);
+    if (id.x >= dstSize.x || id.y >= dstSize.y) {
+        return;
+    }
+    let srcSize = textureDimensions(srcMip);
+    let base = id.xy * 2u;
+
+    // Odd source sizes leave a trailing row/column behind; fold it into the
+    // last texel so the pyramid stays conservative
+    let lastX = select(base.x + 1u, srcSize.x - 1u, id.x == dstSize.x - 1u);
+    let lastY = select(base.y + 1u, srcSize.y - 1u, id.y == dstSize.y - 1u);
+
+    var farthest = textureLoad(srcMip, base, 0).r;
+    for (var y = base.y; y <= lastY; y++) {
+        for (var x = base.x; x <= lastX; x++) {
+            farthest = farther(farthest, textureLoad(srcMip, vec2u(x, y), 0).r);
+        }
+    }
+    textureStore(dstMip, id.xy, vec4f(farthest, 0.0, 0.0, 1.0));
+}
@@ -0,0 +1,154 @@
+#include <cstdio>
+#include "input_thread.h"
+
+void input_queue_init(InputQueue* queue) {
+    queue->head.store(0);
+    queue->tail.store(0);
+}
+
+bool input_queue_push(InputQueue* queue, const InputSnapshot* snapshot) {
+    uint32_t tail = queue->tail.load(std::memory_order_relaxed);
+    if (tail - queue->head.load(std::memory_order_acquire) == INPUT_QUEUE_SIZE) {
+        return false;
+    }
+    queue->slots[tail & (INPUT_QUEUE_SIZE - 1)] = *snapshot;
+    // Publish the slot before the consumer can see the new tail
+    queue->tail.store(tail + 1,std::memory_order_release);
+    return true;
+}
+
+bool input_queue_pop(InputQueue* queue, InputSnapshot* snapshot) {
+    uint32_t head = queue->head.load(std::memory_order_relaxed);
+    if (head == queue->tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    *snapshot = queue->slots[head & (INPUT_QUEUE_SIZE - 1)];
+    // Hand the slot back to the producer only after it was copied out
+    queue->head.store(head + 1,std::memory_order_release);
+    return true;
+}
+
+// The first event after a push starts the latency clock for the next snapshot
+static void mark_changed(InputState* state) {
+    if (!state->dirty) {
+        state->current.eventTime = std::chrono::steady_clock::now();
+        state->dirty = true;
+    }
+}
+
+static void cursor_callback(GLFWwindow* window, double x, double y) {
+    InputState* state = (InputState*)glfwGetWindowUserPointer(window);
+    if (state->width <= 0 || state->height <= 0) {
+        return;
+    }
+    mark_changed(state);
+    state->current.pointer[0] = (float)(2.0 * x / state->width - 1.0);
+    state->current.pointer[1] = (float)(1.0 - 2.0 * y / state->height);
+}
+
+static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
+    InputState* state = (InputState*)glfwGetWindowUserPointer(window);
+    if (button < 0 || button >= 32) {
+        return;
+    }
+    mark_changed(state);
+    if (action == GLFW_PRESS) {
+        state->current.buttons |= 1u << button;
+    } else if (action == GLFW_RELEASE) {
+        state->current.buttons &= ~(1u << button);
+    }
+}
+
+static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    InputState* state = (InputState*)glfwGetWindowUserPointer(window);
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
+        mark_changed(state);
+        state->current.command = INPUT_COMMAND_QUIT;
+    } else if (key == GLFW_KEY_T && action == GLFW_PRESS && state->current.command != INPUT_COMMAND_QUIT) {
+        mark_changed(state);
+        state->current.command = INPUT_COMMAND_NEXT_TEXTURE;
+    }
+}
+
+void input_state_attach(InputState* state, GLFWwindow* window) {
+    state->current = {};
+    // Same light direction fs_main used before it followed the cursor
+    state->current.pointer[0] = 0.4f;
+    state->current.pointer[1] = 0.8f;
+    state->current.command = INPUT_COMMAND_NONE;
+    state->dirty = false;
+    // Cursor positions come in window coordinates, not framebuffer pixels
+    glfwGetWindowSize(window,&state->width,&state->height);
+
+    glfwSetWindowUserPointer(window,state);
+    glfwSetCursorPosCallback(window,cursor_callback);
+    glfwSetMouseButtonCallback(window,mouse_button_callback);
+    glfwSetKeyCallback(window,key_callback);
+}
+
+void input_state_poll(InputState* state, GLFWwindow* window, InputQueue* queue, double timeoutSeconds) {
+    // Sleeps until an event arrives instead of spinning, and wakes up right
+    // away when one does
+    glfwWaitEventsTimeout(timeoutSeconds);
+
+    if (glfwWindowShouldClose(window) && state->current.command != INPUT_COMMAND_QUIT) {
+        mark_changed(state);
+        state->current.command = INPUT_COMMAND_QUIT;
+    }
+
+    if (state->dirty && input_queue_push(queue,&state->current)) {
+        state->dirty = false;
+        // Quitting sticks, everything else happens once per key press
+        if (state->current.command != INPUT_COMMAND_QUIT) {
+            state->current.command = INPUT_COMMAND_NONE;
+        }
+    }
+}
+
+typedef struct LatencySample {
+    InputLatency* latency;
+    std::chrono::steady_clock::time_point eventTime;
+} LatencySample;
+
+static void latency_done_callback(WGPUQueueWorkDoneStatus status, void* userdata1, void* userdata2) {
+    LatencySample* sample = (LatencySample*)userdata1;
+    if (status == WGPUQueueWorkDoneStatus_Success) {
+        std::chrono::duration<double,std::milli> elapsed = std::chrono::steady_clock::now() - sample->eventTime;
+        InputLatency* latency = sample->latency;
+        latency->samples++;
+        latency->totalMs += elapsed.count();
+        latency->windowSamples++;
+        latency->windowTotalMs += elapsed.count();
+        if (elapsed.count() > latency->maxMs) {
+            latency->maxMs = elapsed.count();
+        }
+    }
+    delete sample;
+}
+
+void input_latency_init(InputLatency* latency) {
+    latency->samples = 0;
+    latency->totalMs = 0.0;
+    latency->maxMs = 0.0;
+    latency->windowSamples = 0;
+    latency->windowTotalMs = 0.0;
+}
+
+void input_latency_track(InputLatency* latency, WGPUQueue queue, std::chrono::steady_clock::time_point eventTime) {
+    WGPUQueueWorkDoneCallbackInfo doneInfo = {};
+    doneInfo.nextInChain = nullptr;
+    doneInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+    doneInfo.callback = &latency_done_callback;
+    doneInfo.userdata1 = new LatencySample{latency, eventTime};
+    wgpuQueueOnSubmittedWorkDone(queue,doneInfo);
+}
+
+void input_latency_report(InputLatency* latency) {
+    if (latency->windowSamples > 0) {
+        printf("Input-to-GPU-done latency: %.2f ms average over %llu inputs (%.2f ms overall, %.2f ms max)\n",
+            latency->windowTotalMs / latency->windowSamples, (unsigned long long)latency->windowSamples,
+            latency->totalMs / latency->samples, latency->maxMs);
+    }
+    latency->windowSamples = 0;
+    latency->windowTotalMs = 0.0;
+}
@@ -0,0 +1,82 @@
+#ifndef SIMPLE_WEBGPU_INPUT_THREAD_H
+#define SIMPLE_WEBGPU_INPUT_THREAD_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <webgpu/webgpu.h>
+#include <GLFW/glfw3.h>
+
+// Input is polled on the main thread (GLFW wants that) and handed to the
+// render thread as snapshots, so neither one ever waits on the other.
+
+typedef enum InputCommand {
+    INPUT_COMMAND_NONE = 0,
+    INPUT_COMMAND_QUIT,         // window closed or Escape pressed
+    INPUT_COMMAND_NEXT_TEXTURE, // T: bind the next streamed texture
+} InputCommand;
+
+// Input state as of one poll
+typedef struct InputSnapshot {
+    float pointer[2];     // cursor in [-1, 1], y up
+    uint32_t buttons;     // bit per mouse button
+    InputCommand command;
+    // When the first event that went into this snapshot was received, for
+    // measuring input-to-photon latency
+    std::chrono::steady_clock::time_point eventTime;
+} InputSnapshot;
+
+#define INPUT_QUEUE_SIZE 64 // power of two
+
+// Lock-free single-producer/single-consumer ring of snapshots. head is only
+// written by the consumer and tail only by the producer.
+typedef struct InputQueue {
+    InputSnapshot slots[INPUT_QUEUE_SIZE];
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+} InputQueue;
+
+void input_queue_init(InputQueue* queue);
+
+// Producer side. Returns false when the queue is full.
+bool input_queue_push(InputQueue* queue, const InputSnapshot* snapshot);
+
+// Consumer side. Returns false when the queue is empty.
+bool input_queue_pop(InputQueue* queue, InputSnapshot* snapshot);
+
+// What the GLFW callbacks have collected since the last snapshot was queued
+typedef struct InputState {
+    InputSnapshot current;
+    bool dirty; // something changed since the last push
+    int width;
+    int height;
+} InputState;
+
+// Install the GLFW callbacks. state has to outlive the window.
+void input_state_attach(InputState* state, GLFWwindow* window);
+
+// Wait for events (at most timeoutSeconds) and queue a snapshot if anything
+// changed. A snapshot that doesn't fit is kept and retried on the next call.
+void input_state_poll(InputState* state, GLFWwindow* window, InputQueue* queue, double timeoutSeconds);
+
+// Time from an input event to the GPU finishing the first frame that used it.
+// Presentation adds at most one more refresh on top, which WebGPU can't see.
+// Only touched on the render thread, the callbacks run in ProcessEvents there.
+typedef struct InputLatency {
+    uint64_t samples;
+    double totalMs;
+    double maxMs;
+    // Since the last input_latency_report()
+    uint64_t windowSamples;
+    double windowTotalMs;
+} InputLatency;
+
+void input_latency_init(InputLatency* latency);
+
+// Call after submitting the frame that consumed an input received at eventTime
+void input_latency_track(InputLatency* latency, WGPUQueue queue, std::chrono::steady_clock::time_point eventTime);
+
+// Print the average since the last report, then start a new window
+void input_latency_report(InputLatency* latency);
+
+#endif // SIMPLE_WEBGPU_INPUT_THREAD_H
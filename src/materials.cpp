@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "materials.h"
+#include "webgpu_utils.h"
+#include "gpu_resources.h"
+
+static uint32_t pipeline_slot(const MaterialData* material) {
+    return material->features & MATERIAL_FEATURE_MASK;
+}
+
+// Materials that don't sample a texture can go with any bind group, so
+// they all take the first one instead of splitting their pipeline's draws
+static uint32_t bind_group_slot(const MaterialData* material) {
+    return (material->features & SHADER_FEATURE_TEXTURE) ? material->textureSlot : 0;
+}
+
+uint64_t material_draw_key(uint32_t pipelineSlot, uint32_t bindGroupSlot, float depth) {
+    // Non-negative floats order the same as their bits
+    depth = depth > 0.0f ? depth : 0.0f;
+    uint32_t depthBits;
+    memcpy(&depthBits,&depth,sizeof(depthBits));
+    return ((uint64_t)(pipelineSlot & 0xffff) << 48) | ((uint64_t)(bindGroupSlot & 0xffff) << 32) | depthBits;
+}
+
+bool material_system_create(MaterialSystem* system, WGPUDevice device, const MaterialData* materials, uint32_t materialCount,
+                            const uint32_t* instanceMaterials, const float* instanceDepths, uint32_t instanceCount,
+                            bool cpuDraws, bool sortDraws) {
+    *system = {};
+    system->materialCount = materialCount;
+    system->instanceCount = instanceCount;
+    system->cpuDraws = cpuDraws;
+    system->sortDraws = sortDraws;
+    system->materials.assign(materials,materials + materialCount);
+    system->instanceMaterials.assign(instanceMaterials,instanceMaterials + instanceCount);
+    if (cpuDraws) {
+        system->instanceDepths.assign(instanceDepths,instanceDepths + instanceCount);
+    }
+
+    system->materialBuffer = BufferHandle(create_buffer_with_data(device,"Material buffer",
+        WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst,materials,materialCount * sizeof(MaterialData)));
+    system->instanceMaterialBuffer = BufferHandle(create_buffer_with_data(device,"Instance material buffer",
+        WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst,instanceMaterials,instanceCount * sizeof(uint32_t)));
+    if (!system->materialBuffer || !system->instanceMaterialBuffer) {
+        return false;
+    }
+    if (!cpuDraws) {
+        return true;
+    }
+
+    WGPUBufferDescriptor bufferDesc = {};
+    bufferDesc.label = {"Material draw order",WGPU_STRLEN};
+    bufferDesc.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst;
+    bufferDesc.nextInChain = nullptr;
+    bufferDesc.size = instanceCount * sizeof(uint32_t);
+    bufferDesc.mappedAtCreation = false;
+    system->drawOrderBuffer = BufferHandle(tracked_create_buffer(device,&bufferDesc));
+    if (!system->drawOrderBuffer) {
+        return false;
+    }
+
+    // What drawing in scene order would cost, to put the sorted numbers in context
+    uint32_t lastPipeline = UINT32_MAX;
+    uint32_t lastBindGroup = UINT32_MAX;
+    for (uint32_t i = 0; i < instanceCount; i++) {
+        const MaterialData* material = &system->materials[instanceMaterials[i]];
+        system->stats.unsortedPipelineChanges += pipeline_slot(material) != lastPipeline;
+        system->stats.unsortedBindGroupChanges += bind_group_slot(material) != lastBindGroup;
+        lastPipeline = pipeline_slot(material);
+        lastBindGroup = bind_group_slot(material);
+    }
+
+    printf("Materials: %u materials on %u instances, drawn %s\n", materialCount, instanceCount,
+        sortDraws ? "sorted by pipeline, bind group and depth" : "in scene order");
+    return true;
+}
+
+void material_system_sort_draws(MaterialSystem* system) {
+    system->draws.resize(system->instanceCount);
+    for (uint32_t i = 0; i < system->instanceCount; i++) {
+        const MaterialData* material = &system->materials[system->instanceMaterials[i]];
+        system->draws[i].key = material_draw_key(pipeline_slot(material),bind_group_slot(material),system->instanceDepths[i]);
+        system->draws[i].instance = i;
+    }
+    if (system->sortDraws) {
+        std::sort(system->draws.begin(),system->draws.end(),[](const MaterialDraw& a, const MaterialDraw& b) {
+            return a.key < b.key;
+        });
+    }
+
+    // Neighbours with the same state become one instanced draw
+    system->drawOrder.resize(system->instanceCount);
+    system->runs.clear();
+    for (uint32_t i = 0; i < system->instanceCount; i++) {
+        uint64_t state = system->draws[i].key >> 32;
+        system->drawOrder[i] = system->draws[i].instance;
+        if (!system->runs.empty() && (system->draws[i - 1].key >> 32) == state) {
+            system->runs.back().instanceCount++;
+            continue;
+        }
+        MaterialRun run = {i, 1, (uint32_t)(state >> 16), (uint32_t)(state & 0xffff)};
+        system->runs.push_back(run);
+    }
+}
+
+void material_system_build_draws(MaterialSystem* system, WGPUQueue queue) {
+    if (!system->cpuDraws) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    material_system_sort_draws(system);
+    wgpuQueueWriteBuffer(queue,system->drawOrderBuffer,0,system->drawOrder.data(),system->drawOrder.size() * sizeof(uint32_t));
+
+    std::chrono::duration<double,std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    system->stats.sortMs = elapsed.count();
+}
+
+void material_system_encode(MaterialSystem* system, WGPURenderPassEncoder renderPass) {
+    auto start = std::chrono::steady_clock::now();
+    MaterialDrawStats* stats = &system->stats;
+    stats->draws = 0;
+    stats->pipelineChanges = 0;
+    stats->bindGroupChanges = 0;
+
+    WGPURenderPipeline pipeline = nullptr;
+    WGPUBindGroup bindGroup = nullptr;
+    for (const MaterialRun& run : system->runs) {
+        if (system->pipelines[run.pipelineSlot] != pipeline) {
+            pipeline = system->pipelines[run.pipelineSlot];
+            wgpuRenderPassEncoderSetPipeline(renderPass,pipeline);
+            stats->pipelineChanges++;
+        }
+        if (system->bindGroups[run.bindGroupSlot] != bindGroup) {
+            bindGroup = system->bindGroups[run.bindGroupSlot];
+            wgpuRenderPassEncoderSetBindGroup(renderPass,0,bindGroup,0,nullptr);
+            stats->bindGroupChanges++;
+        }
+        // instance_index starts at firstInstance, vs_main looks the id up in the draw order
+        wgpuRenderPassEncoderDrawIndexed(renderPass,36,run.instanceCount,0,0,run.firstInstance);
+        stats->draws++;
+    }
+
+    std::chrono::duration<double,std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    stats->encodeMs = elapsed.count();
+    stats->windowSortMs += stats->sortMs;
+    stats->windowEncodeMs += stats->encodeMs;
+    stats->windowFrames++;
+}
+
+void material_system_report(MaterialSystem* system) {
+    MaterialDrawStats* stats = &system->stats;
+    if (!system->cpuDraws || stats->windowFrames == 0) {
+        return;
+    }
+    printf("Materials: %u draws, %u pipeline and %u bind group changes per frame (%u and %u in scene order), "
+        "sort %.3f ms, encode %.3f ms\n", stats->draws, stats->pipelineChanges, stats->bindGroupChanges,
+        stats->unsortedPipelineChanges, stats->unsortedBindGroupChanges,
+        stats->windowSortMs / stats->windowFrames, stats->windowEncodeMs / stats->windowFrames);
+    stats->windowSortMs = 0.0;
+    stats->windowEncodeMs = 0.0;
+    stats->windowFrames = 0;
+}
+
+void material_system_release(MaterialSystem* system) {
+    *system = {};
+}
@@ -0,0 +1,114 @@
+#ifndef SIMPLE_WEBGPU_MATERIALS_H
+#define SIMPLE_WEBGPU_MATERIALS_H
+
+#include <cstdint>
+#include <vector>
+#include <webgpu/webgpu.h>
+#include "gpu_resources.h"
+#include "shader_variants.h"
+
+// Features a material can switch on. Every combination is its own pipeline.
+#define MATERIAL_FEATURE_MASK (SHADER_FEATURE_LIGHTING | SHADER_FEATURE_FOG | SHADER_FEATURE_TEXTURE)
+#define MATERIAL_PIPELINE_SLOTS 8
+// Streamed textures materials sample, one scene bind group each. Kept
+// small so they all fit the default texture budget at once.
+#define MATERIAL_TEXTURE_SLOTS 2
+
+// Must match Material in simple_shader.wgsl
+typedef struct MaterialData {
+    float color[4];       // multiplies the instance color, w unused
+    float uvScale;        // how often FEATURE_TEXTURE repeats the texture
+    uint32_t features;    // SHADER_FEATURE_* within MATERIAL_FEATURE_MASK, picks the pipeline
+    uint32_t textureSlot; // < MATERIAL_TEXTURE_SLOTS, picks the bind group
+    uint32_t padding;
+} MaterialData;
+
+// Sort key of one instance: pipeline in the top 16 bits, bind group in the
+// next 16 and depth in the low 32, so sorted draws change pipelines least
+// often, then bind groups, and go front to back within the same state
+typedef struct MaterialDraw {
+    uint64_t key;
+    uint32_t instance;
+} MaterialDraw;
+
+// Sorted draws sharing a pipeline and bind group. They sit next to each
+// other in the draw order, so one instanced draw covers them.
+typedef struct MaterialRun {
+    uint32_t firstInstance; // into the draw order buffer
+    uint32_t instanceCount;
+    uint32_t pipelineSlot;
+    uint32_t bindGroupSlot;
+} MaterialRun;
+
+typedef struct MaterialDrawStats {
+    // Last frame
+    uint32_t draws;
+    uint32_t pipelineChanges;
+    uint32_t bindGroupChanges;
+    double sortMs;
+    double encodeMs;
+    // State changes the draws would need in scene order, for comparison
+    uint32_t unsortedPipelineChanges;
+    uint32_t unsortedBindGroupChanges;
+    // Since the last report
+    double windowSortMs;
+    double windowEncodeMs;
+    uint32_t windowFrames;
+} MaterialDrawStats;
+
+// Material parameters for every instance in one storage buffer, indexed
+// through a per-instance material id, so materials never need their own
+// bind group. What still changes between materials is the pipeline
+// (features) and the bind group (texture). With cpuDraws the instances are
+// drawn from a list sorted by those, instead of the culling pass's lists.
+typedef struct MaterialSystem {
+    uint32_t materialCount;
+    uint32_t instanceCount;
+    bool cpuDraws;
+    bool sortDraws; // off: draw in scene order, to measure what sorting buys
+
+    std::vector<MaterialData> materials;
+    std::vector<uint32_t> instanceMaterials;
+    std::vector<float> instanceDepths;
+    std::vector<MaterialDraw> draws;
+    std::vector<uint32_t> drawOrder; // instance ids, read as visibleIds
+    std::vector<MaterialRun> runs;
+
+    BufferHandle materialBuffer;
+    BufferHandle instanceMaterialBuffer;
+    BufferHandle drawOrderBuffer; // cpuDraws only
+    // Filled in by the renderer every frame
+    WGPURenderPipeline pipelines[MATERIAL_PIPELINE_SLOTS];
+    WGPUBindGroup bindGroups[MATERIAL_TEXTURE_SLOTS];
+
+    MaterialDrawStats stats;
+} MaterialSystem;
+
+// instanceDepths (of every instance's center, 0 at the near plane and 1 at
+// the far one whatever the depth convention) are only needed with cpuDraws.
+// Returns false when the GPU memory budget doesn't leave room for it.
+bool material_system_create(MaterialSystem* system, WGPUDevice device, const MaterialData* materials, uint32_t materialCount,
+                            const uint32_t* instanceMaterials, const float* instanceDepths, uint32_t instanceCount,
+                            bool cpuDraws, bool sortDraws);
+
+// MaterialDraw::key for an instance. depth below 0 counts as 0.
+uint64_t material_draw_key(uint32_t pipelineSlot, uint32_t bindGroupSlot, float depth);
+
+// Fill draws, drawOrder and runs from the instances, sorted unless
+// sortDraws is off. CPU only, material_system_build_draws() calls it.
+void material_system_sort_draws(MaterialSystem* system);
+
+// Sort the draws, group them into runs and upload the draw order. Call
+// once per frame before encoding.
+void material_system_build_draws(MaterialSystem* system, WGPUQueue queue);
+
+// One instanced draw per run, setting the pipeline and bind group 0 only
+// when they change. The other bind groups must already be set.
+void material_system_encode(MaterialSystem* system, WGPURenderPassEncoder renderPass);
+
+// State changes and CPU time per frame since the last report
+void material_system_report(MaterialSystem* system);
+
+void material_system_release(MaterialSystem* system);
+
+#endif // SIMPLE_WEBGPU_MATERIALS_H
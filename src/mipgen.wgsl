@@ -0,0 +1,24 @@
+// Builds one mip level from the one above it with a 2x2 box filter. Run once
+// per missing level, finest first (see texture_streaming.cpp).
+
+@group(0) @binding(0) var source: texture_2d<f32>;
+@group(0) @binding(1) var destination: texture_storage_2d<rgba8unorm, write>;
+
+@compute @workgroup_size(8, 8)
+fn downsample(@builtin(global_invocation_id) id: vec3u) {
+	let size = textureDimensions(destination);
+	if (id.x >= size.x || id.y >= size.y) {
+		return;
+	}
+
+	// Odd sizes: the last texel of the row/column gets sampled twice
+	let sourceMax = textureDimensions(source) - vec2u(1u);
+	let base = id.xy * 2u;
+	var sum = vec4f(0.0);
+	for (var y = 0u; y < 2u; y++) {
+		for (var x = 0u; x < 2u; x++) {
+			sum += textureLoad(source, min(base + vec2u(x, y), sourceMax), 0);
+		}
+	}
+	textureStore(destination, id.xy, sum * 0.25);
+}
@@ -0,0 +1,180 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "multi_view.h"
+#include "webgpu_utils.h"
+#include "gpu_resources.h"
+
+// Must match MultiViewParams in multi_view.wgsl
+typedef struct MultiViewParams {
+    uint32_t instanceCount;
+    uint32_t viewCount;
+    uint32_t padding[2];
+} MultiViewParams;
+
+// A texture array with one layer per view and a 2D view of every layer
+static WGPUTexture create_layered_target(WGPUDevice device, const char* label, WGPUTextureFormat format, WGPUTextureUsage usage,
+                                         uint32_t width, uint32_t height, uint32_t layers, WGPUTextureAspect aspect,
+                                         std::vector<TextureViewHandle>* views) {
+    WGPUTextureDescriptor textureDesc = {};
+    textureDesc.label = {label,WGPU_STRLEN};
+    textureDesc.dimension = WGPUTextureDimension_2D;
+    textureDesc.format = format;
+    textureDesc.mipLevelCount = 1;
+    textureDesc.sampleCount = 1;
+    textureDesc.size = {width, height, layers};
+    textureDesc.usage = usage;
+    textureDesc.viewFormatCount = 1;
+    textureDesc.viewFormats = &format;
+    WGPUTexture texture = tracked_create_texture(device,&textureDesc);
+    if (!texture) {
+        return nullptr;
+    }
+
+    for (uint32_t layer = 0; layer < layers; layer++) {
+        WGPUTextureViewDescriptor viewDesc = {};
+        viewDesc.nextInChain = nullptr;
+        viewDesc.format = format;
+        viewDesc.dimension = WGPUTextureViewDimension_2D;
+        viewDesc.aspect = aspect;
+        viewDesc.baseMipLevel = 0;
+        viewDesc.mipLevelCount = 1;
+        viewDesc.baseArrayLayer = layer;
+        viewDesc.arrayLayerCount = 1;
+        views->emplace_back(wgpuTextureCreateView(texture,&viewDesc));
+    }
+    return texture;
+}
+
+bool multi_view_create(MultiView* multiView, WGPUDevice device, const ViewData* views, uint32_t viewCount, bool batch,
+                       uint32_t width, uint32_t height, WGPUTextureFormat colorFormat, WGPUTextureFormat depthFormat,
+                       WGPUBuffer instanceBuffer, uint32_t instanceCount, uint32_t indexCount,
+                       const TransformConstants* transform) {
+    *multiView = {};
+    multiView->viewCount = viewCount;
+    multiView->instanceCount = instanceCount;
+    multiView->batch = batch;
+
+    // Spread out so every view starts at an offset the device accepts
+    std::vector<uint8_t> viewBytes(viewCount * VIEW_DATA_STRIDE,0);
+    for (uint32_t i = 0; i < viewCount; i++) {
+        memcpy(&viewBytes[i * VIEW_DATA_STRIDE],&views[i],sizeof(ViewData));
+    }
+    multiView->viewBuffer = BufferHandle(create_buffer_with_data(device,"View buffer",
+        WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst,viewBytes.data(),viewBytes.size()));
+    if (!multiView->viewBuffer) {
+        return false;
+    }
+
+    // What vs_main reads, one view per draw
+    WGPUBindGroupLayoutEntry layoutEntry = buffer_layout_entry(0,WGPUShaderStage_Vertex,WGPUBufferBindingType_ReadOnlyStorage);
+    layoutEntry.buffer.hasDynamicOffset = true;
+    layoutEntry.buffer.minBindingSize = sizeof(ViewData);
+    WGPUBindGroupLayoutDescriptor layoutDesc = {};
+    layoutDesc.label = {"Scene view layout",WGPU_STRLEN};
+    layoutDesc.entryCount = 1;
+    layoutDesc.entries = &layoutEntry;
+    multiView->layout = BindGroupLayoutHandle(wgpuDeviceCreateBindGroupLayout(device,&layoutDesc));
+
+    WGPUBindGroupEntry entry = buffer_entry(0,multiView->viewBuffer,sizeof(ViewData));
+    WGPUBindGroupDescriptor bindGroupDesc = {};
+    bindGroupDesc.label = {"Scene view bind group",WGPU_STRLEN};
+    bindGroupDesc.layout = multiView->layout;
+    bindGroupDesc.entryCount = 1;
+    bindGroupDesc.entries = &entry;
+    multiView->bindGroup = BindGroupHandle(wgpuDeviceCreateBindGroup(device,&bindGroupDesc));
+
+    if (!batch) {
+        return true;
+    }
+
+    // Render targets, copyable so the layers can be read back
+    multiView->colorTexture = TextureHandle(create_layered_target(device,"Batch color layers",colorFormat,
+        WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_CopySrc,width,height,viewCount,
+        WGPUTextureAspect_All,&multiView->colorViews));
+    multiView->depthTexture = TextureHandle(create_layered_target(device,"Batch depth layers",depthFormat,
+        WGPUTextureUsage_RenderAttachment,width,height,viewCount,
+        WGPUTextureAspect_DepthOnly,&multiView->depthViews));
+
+    MultiViewParams params = {instanceCount, viewCount, {0, 0}};
+    multiView->paramsBuffer = BufferHandle(create_buffer_with_data(device,"Multi-view params",
+        WGPUBufferUsage_Uniform,&params,sizeof(params)));
+    uint32_t drawArgs[5] = {indexCount, 0, 0, 0, 0};
+    multiView->drawArgsBuffer = BufferHandle(create_buffer_with_data(device,"Multi-view draw args",
+        WGPUBufferUsage_Storage | WGPUBufferUsage_Indirect | WGPUBufferUsage_CopyDst,drawArgs,sizeof(drawArgs)));
+    multiView->visibleListBuffer = BufferHandle(create_empty_buffer(device,"Multi-view visible list",
+        WGPUBufferUsage_Storage,(instanceCount > 0 ? instanceCount : 1) * sizeof(uint32_t)));
+    if (!multiView->colorTexture || !multiView->depthTexture || !multiView->paramsBuffer ||
+        !multiView->drawArgsBuffer || !multiView->visibleListBuffer) {
+        return false;
+    }
+
+    // Shared culling
+    std::string source = LoadWGSLShader("src/transform.wgsl") + LoadWGSLShader("src/multi_view.wgsl");
+    WGPUShaderModule module = create_shader_module(device,source,"Multi-view cull shader");
+
+    WGPUBindGroupLayoutEntry cullLayoutEntries[5] = {
+        buffer_layout_entry(0,WGPUShaderStage_Compute,WGPUBufferBindingType_Uniform),
+        buffer_layout_entry(1,WGPUShaderStage_Compute,WGPUBufferBindingType_ReadOnlyStorage),
+        buffer_layout_entry(2,WGPUShaderStage_Compute,WGPUBufferBindingType_ReadOnlyStorage),
+        buffer_layout_entry(3,WGPUShaderStage_Compute,WGPUBufferBindingType_Storage),
+        buffer_layout_entry(4,WGPUShaderStage_Compute,WGPUBufferBindingType_Storage)
+    };
+    WGPUBindGroupLayoutDescriptor cullLayoutDesc = {};
+    cullLayoutDesc.label = {"Multi-view cull layout",WGPU_STRLEN};
+    cullLayoutDesc.entryCount = 5;
+    cullLayoutDesc.entries = cullLayoutEntries;
+    WGPUBindGroupLayout cullLayout = wgpuDeviceCreateBindGroupLayout(device,&cullLayoutDesc);
+
+    WGPUConstantEntry transformConstants[TRANSFORM_CONSTANT_COUNT];
+    transform_constant_entries(transform,transformConstants);
+    multiView->cullPipeline = ComputePipelineHandle(create_compute_pipeline(device,cullLayout,module,"cull_views",TRANSFORM_CONSTANT_COUNT,transformConstants));
+
+    WGPUBindGroupEntry cullEntries[5] = {
+        buffer_entry(0,multiView->paramsBuffer),
+        buffer_entry(1,instanceBuffer),
+        buffer_entry(2,multiView->viewBuffer),
+        buffer_entry(3,multiView->drawArgsBuffer),
+        buffer_entry(4,multiView->visibleListBuffer)
+    };
+    WGPUBindGroupDescriptor cullDesc = {};
+    cullDesc.label = {"Multi-view cull bind group",WGPU_STRLEN};
+    cullDesc.layout = cullLayout;
+    cullDesc.entryCount = 5;
+    cullDesc.entries = cullEntries;
+    multiView->cullBindGroup = BindGroupHandle(wgpuDeviceCreateBindGroup(device,&cullDesc));
+    wgpuBindGroupLayoutRelease(cullLayout);
+    wgpuShaderModuleRelease(module);
+
+    printf("Batch rendering: %u views of %ux%u into texture array layers\n", viewCount, width, height);
+    return true;
+}
+
+uint32_t multi_view_offset(uint32_t view) {
+    return view * VIEW_DATA_STRIDE;
+}
+
+void multi_view_begin_frame(MultiView* multiView, WGPUQueue queue) {
+    if (!multiView->batch) {
+        return;
+    }
+    // Only the instance count is reset, the rest of the indirect args stays put
+    uint32_t zero = 0;
+    wgpuQueueWriteBuffer(queue,multiView->drawArgsBuffer,sizeof(uint32_t),&zero,sizeof(zero));
+}
+
+void multi_view_encode_cull(MultiView* multiView, WGPUCommandEncoder encoder) {
+    WGPUComputePassDescriptor passDesc = {};
+    passDesc.label = {"Multi-view cull pass",WGPU_STRLEN};
+    WGPUComputePassEncoder pass = wgpuCommandEncoderBeginComputePass(encoder,&passDesc);
+    wgpuComputePassEncoderSetPipeline(pass,multiView->cullPipeline);
+    wgpuComputePassEncoderSetBindGroup(pass,0,multiView->cullBindGroup,0,nullptr);
+    wgpuComputePassEncoderDispatchWorkgroups(pass,workgroup_count(multiView->instanceCount,64),1,1);
+    wgpuComputePassEncoderEnd(pass);
+    wgpuComputePassEncoderRelease(pass);
+}
+
+void multi_view_release(MultiView* multiView) {
+    *multiView = {};
+}
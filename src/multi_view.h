@@ -0,0 +1,70 @@
+#ifndef SIMPLE_WEBGPU_MULTI_VIEW_H
+#define SIMPLE_WEBGPU_MULTI_VIEW_H
+
+#include <cstdint>
+#include <vector>
+#include <webgpu/webgpu.h>
+#include "gpu_resources.h"
+#include "shader_variants.h"
+
+// Layers of a 2D texture array, i.e. the default maxTextureArrayLayers
+#define MULTI_VIEW_MAX_VIEWS 256
+
+// Views sit this far apart in the view buffer, the default
+// minStorageBufferOffsetAlignment, so a dynamic offset can pick one
+#define VIEW_DATA_STRIDE 256
+
+// One camera. Must match View in simple_shader.wgsl/multi_view.wgsl
+typedef struct ViewData {
+    float camera[16]; // column-major, object space -> the scene project() tilts
+} ViewData;
+
+// Cameras the scene pipelines can draw from (group 2, one view per draw
+// through a dynamic offset). The window uses a single identity view. In
+// batch mode there are several, each rendering into its own layer of a color
+// and depth texture array. Occlusion culling only holds for the window's
+// camera, so batch mode culls once per frame against the frusta of all views
+// and every view draws that shared list.
+typedef struct MultiView {
+    uint32_t viewCount;
+    uint32_t instanceCount;
+    bool batch;
+
+    BufferHandle viewBuffer;        // ViewData every VIEW_DATA_STRIDE bytes
+    BindGroupLayoutHandle layout;   // group 2 of the scene pipelines
+    BindGroupHandle bindGroup;
+
+    // Batch mode only
+    TextureHandle colorTexture;     // one layer per view
+    TextureHandle depthTexture;
+    std::vector<TextureViewHandle> colorViews;
+    std::vector<TextureViewHandle> depthViews;
+    BufferHandle paramsBuffer;
+    BufferHandle drawArgsBuffer;    // one DrawIndexedIndirect block
+    BufferHandle visibleListBuffer; // instances inside any view's frustum
+    ComputePipelineHandle cullPipeline;
+    BindGroupHandle cullBindGroup;
+} MultiView;
+
+// With batch, views get color (colorFormat) and depth array layers of
+// width x height and instanceBuffer is culled for all of them; otherwise
+// only the view buffer is made. transform has to match what the scene
+// pipelines are specialized with. Returns false when the GPU memory budget
+// doesn't leave room for it.
+bool multi_view_create(MultiView* multiView, WGPUDevice device, const ViewData* views, uint32_t viewCount, bool batch,
+                       uint32_t width, uint32_t height, WGPUTextureFormat colorFormat, WGPUTextureFormat depthFormat,
+                       WGPUBuffer instanceBuffer, uint32_t instanceCount, uint32_t indexCount,
+                       const TransformConstants* transform);
+
+// Dynamic offset that selects a view in bindGroup
+uint32_t multi_view_offset(uint32_t view);
+
+// Reset the shared draw count. Call once per frame before submitting.
+void multi_view_begin_frame(MultiView* multiView, WGPUQueue queue);
+
+// Compute pass building the list every view draws. Batch mode only.
+void multi_view_encode_cull(MultiView* multiView, WGPUCommandEncoder encoder);
+
+void multi_view_release(MultiView* multiView);
+
+#endif // SIMPLE_WEBGPU_MULTI_VIEW_H
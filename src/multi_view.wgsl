@@ -0,0 +1,74 @@
+// Expects transform.wgsl to be prepended (provides project())
+//
+// Culling shared by every view of a batch: an instance is drawn if it lands
+// inside the frustum of at least one view. There is no occlusion test, a
+// Hi-Z pyramid only describes a single camera.
+
+// Must match InstanceData in hiz_culling.h
+struct Instance {
+	center: vec4f,
+	extent: vec4f,
+	color: vec4f,
+};
+
+// Must match ViewData in multi_view.h, padded to VIEW_DATA_STRIDE
+struct View {
+	camera: mat4x4f,
+	padding: array<vec4f, 12>,
+};
+
+// Layout of a DrawIndexedIndirect argument block
+struct DrawArgs {
+	indexCount: u32,
+	instanceCount: atomic<u32>,
+	firstIndex: u32,
+	baseVertex: i32,
+	firstInstance: u32,
+};
+
+struct MultiViewParams {
+	instanceCount: u32,
+	viewCount: u32,
+};
+
+@group(0) @binding(0) var<uniform> params: MultiViewParams;
+@group(0) @binding(1) var<storage, read> instances: array<Instance>;
+@group(0) @binding(2) var<storage, read> views: array<View>;
+@group(0) @binding(3) var<storage, read_write> drawArgs: DrawArgs;
+@group(0) @binding(4) var<storage, read_write> visibleList: array<u32>;
+
+fn in_view_frustum(inst: Instance, camera: mat4x4f) -> bool {
+	var lo = vec3f(1e9);
+	var hi = vec3f(-1e9);
+	for (var i = 0u; i < 8u; i++) {
+		let corner = vec3f(
+			select(-1.0, 1.0, (i & 1u) != 0u),
+			select(-1.0, 1.0, (i & 2u) != 0u),
+			select(-1.0, 1.0, (i & 4u) != 0u),
+		);
+		let p = camera * vec4f(inst.center.xyz + corner * inst.extent.xyz, 1.0);
+		let clip = project(p.xyz);
+		let ndc = clip.xyz / clip.w;
+		lo = min(lo, ndc);
+		hi = max(hi, ndc);
+	}
+	return hi.x >= -1.0 && lo.x <= 1.0 &&
+	       hi.y >= -1.0 && lo.y <= 1.0 &&
+	       hi.z >= 0.0 && lo.z <= 1.0;
+}
+
+@compute @workgroup_size(64)
+fn cull_views(@builtin(global_invocation_id) id: vec3u) {
+	let i = id.x;
+	if (i >= params.instanceCount) {
+		return;
+	}
+	let inst = instances[i];
+	for (var v = 0u; v < params.viewCount; v++) {
+		if (in_view_frustum(inst, views[v].camera)) {
+			let slot = atomicAdd(&drawArgs.instanceCount, 1u);
+			visibleList[slot] = i;
+			return;
+		}
+	}
+}
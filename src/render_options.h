@@ -0,0 +1,49 @@
+#ifndef SIMPLE_WEBGPU_RENDER_OPTIONS_H
+#define SIMPLE_WEBGPU_RENDER_OPTIONS_H
+
+#include <cstdint>
+
+#define RENDER_MAX_TEXTURES 8
+
+// Runtime switches, parsed from the command line in main()
+typedef struct RenderOptions {
+    // Draw depth only first, then shade with an Equal depth test so every
+    // pixel runs fs_main once no matter how much geometry overlaps
+    bool depthPrepass;
+    // Depth32Float cleared to 0 with a Greater test instead of Depth24Plus/Less
+    bool reverseZ;
+    // SHADER_FEATURE_* bits enabled in fs_main
+    uint32_t shaderFeatures;
+    // Branch on the features at runtime through a uniform instead of
+    // specializing them, to measure what specialization buys
+    bool uniformBranching;
+    // "occlusion" (default), "overdraw" or "materials"
+    const char* scene;
+    // Render this many frames as fast as possible, print timings and exit.
+    // 0 runs until the window is closed.
+    uint32_t benchmarkFrames;
+    // Refuse GPU buffer and texture allocations past this many MB (0: no limit)
+    uint32_t memoryBudgetMB;
+    // Files for FEATURE_TEXTURE (see texture_load()), generated checkers if none
+    const char* texturePaths[RENDER_MAX_TEXTURES];
+    uint32_t textureCount;
+    // Mip levels kept on the GPU across all textures, in MB
+    uint32_t textureBudgetMB;
+    // Point and spot lights for FEATURE_LIGHTS
+    uint32_t lightCount;
+    // Loop over every light in fs_main instead of binning them into clusters
+    bool naiveLights;
+    // Benchmark 10 to 10000 lights, clustered and naive, and print a table
+    bool lightSweep;
+    // Render this many camera views per frame into texture array layers
+    // instead of the window (0: off)
+    uint32_t batchViews;
+    // Prefer the fallback (software) adapter
+    bool softwareAdapter;
+    // Prefer integrated GPUs over discrete ones
+    bool lowPower;
+    // Draw the materials scene in scene order instead of sorted by state
+    bool unsortedDraws;
+} RenderOptions;
+
+#endif // SIMPLE_WEBGPU_RENDER_OPTIONS_H
@@ -0,0 +1,292 @@
+#include <cstdio>
+#include <stdexcept>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+#include "shader_reload.h"
+#include "webgpu_utils.h"
+
+static std::string directory_of(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? "." : path.substr(0,slash);
+}
+
+static std::string file_name_of(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// Read every watched file again and hand the result to the main thread. A
+// file can briefly be missing while an editor replaces it; the rename that
+// puts it back triggers another read.
+static void read_sources(ShaderReload* reload) {
+    std::string source;
+    std::vector<uint32_t> lines;
+    try {
+        for (size_t i = 0; i < reload->paths.size(); i++) {
+            std::string text = i < reload->fixedCount ? reload->fixedSources[i] : LoadWGSLShader(reload->paths[i]);
+            uint32_t count = 0;
+            for (char c : text) {
+                count += c == '\n';
+            }
+            source += text;
+            lines.push_back(count);
+        }
+    } catch (const std::runtime_error& e) {
+        fprintf(stderr,"Shader reload: %s\n",e.what());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(reload->sourceMutex);
+    reload->source = std::move(source);
+    reload->sourceLines = std::move(lines);
+    reload->sourceReady = true;
+}
+
+#ifdef __linux__
+static bool is_watched(const ShaderReload* reload, const struct inotify_event* event) {
+    if (event->len == 0) {
+        return false;
+    }
+    for (size_t i = reload->fixedCount; i < reload->paths.size(); i++) {
+        if (reload->watchIds[i - reload->fixedCount] == event->wd && file_name_of(reload->paths[i]) == event->name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void watch_loop(ShaderReload* reload) {
+    alignas(struct inotify_event) char buffer[4096];
+    bool dirty = false;
+    auto lastEvent = std::chrono::steady_clock::now();
+
+    while (!reload->stop) {
+        // Short timeout so the thread notices stop and the end of the debounce
+        struct pollfd pfd = {reload->inotifyFd, POLLIN, 0};
+        if (poll(&pfd,1,50) > 0 && (pfd.revents & POLLIN)) {
+            ssize_t length = read(reload->inotifyFd,buffer,sizeof(buffer));
+            for (ssize_t offset = 0; offset < length; ) {
+                const struct inotify_event* event = (const struct inotify_event*)(buffer + offset);
+                if (is_watched(reload,event)) {
+                    dirty = true;
+                    lastEvent = std::chrono::steady_clock::now();
+                }
+                offset += sizeof(struct inotify_event) + event->len;
+            }
+        }
+
+        std::chrono::duration<double,std::milli> quiet = std::chrono::steady_clock::now() - lastEvent;
+        if (dirty && quiet.count() >= SHADER_RELOAD_DEBOUNCE_MS) {
+            dirty = false;
+            read_sources(reload);
+        }
+    }
+}
+#endif
+
+bool shader_reload_start(ShaderReload* reload, WGPUInstance instance, WGPUDevice device, const std::vector<std::string>& paths,
+                         size_t fixedCount) {
+    reload->paths = paths;
+    reload->fixedCount = fixedCount < paths.size() ? fixedCount : paths.size();
+    reload->fixedSources.clear();
+    reload->instance = instance;
+    reload->device = device;
+    reload->inotifyFd = -1;
+    reload->watchIds.clear();
+    reload->stop = false;
+    reload->sourceReady = false;
+    reload->pendingCache = nullptr;
+    reload->outstanding = 0;
+    reload->failed = false;
+    reload->reloads = 0;
+    reload->failures = 0;
+
+    // Keep what the fixed files held at startup, however they change later
+    try {
+        for (size_t i = 0; i < reload->fixedCount; i++) {
+            reload->fixedSources.push_back(LoadWGSLShader(paths[i]));
+        }
+    } catch (const std::runtime_error& e) {
+        fprintf(stderr,"Shader reload: %s\n",e.what());
+        return false;
+    }
+
+#ifdef __linux__
+    reload->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (reload->inotifyFd < 0) {
+        perror("inotify_init1");
+        return false;
+    }
+
+    // Watch the directories rather than the files. Editors often save by
+    // writing a new file and renaming it over the old one, which would leave
+    // a watch on the file itself pointing at the deleted inode.
+    for (size_t i = reload->fixedCount; i < paths.size(); i++) {
+        const std::string& path = paths[i];
+        int wd = inotify_add_watch(reload->inotifyFd,directory_of(path).c_str(),IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (wd < 0) {
+            perror(path.c_str());
+            close(reload->inotifyFd);
+            reload->inotifyFd = -1;
+            return false;
+        }
+        reload->watchIds.push_back(wd);
+    }
+
+    reload->watcher = std::thread(watch_loop,reload);
+    printf("Watching %zu shader files for changes\n",paths.size() - reload->fixedCount);
+    return true;
+#else
+    return false;
+#endif
+}
+
+static const char* message_type_name(WGPUCompilationMessageType type) {
+    switch (type) {
+        case WGPUCompilationMessageType_Error: return "error";
+        case WGPUCompilationMessageType_Warning: return "warning";
+        default: return "info";
+    }
+}
+
+// Compiler messages count lines in the concatenated source. Print them
+// against the file they actually come from.
+static void compilation_info_callback(WGPUCompilationInfoRequestStatus status, const WGPUCompilationInfo* info, void* userdata1, void* userdata2) {
+    const ShaderReload* reload = (const ShaderReload*)userdata1;
+    if (status != WGPUCompilationInfoRequestStatus_Success || !info) {
+        return;
+    }
+    for (size_t m = 0; m < info->messageCount; m++) {
+        const WGPUCompilationMessage* message = &info->messages[m];
+        uint64_t line = message->lineNum;
+        size_t file = 0;
+        while (file + 1 < reload->fileLines.size() && line > reload->fileLines[file]) {
+            line -= reload->fileLines[file];
+            file++;
+        }
+        fprintf(stderr,"%s:%llu:%llu: %s: %.*s\n", reload->paths[file].c_str(),
+            (unsigned long long)line, (unsigned long long)message->linePos,
+            message_type_name(message->type), (int)message->message.length, message->message.data);
+    }
+}
+
+static void pipeline_ready_callback(WGPUCreatePipelineAsyncStatus status, WGPURenderPipeline pipeline, WGPUStringView message, void* userdata1, void* userdata2) {
+    ShaderReload* reload = (ShaderReload*)userdata1;
+    size_t index = (size_t)userdata2;
+
+    if (status == WGPUCreatePipelineAsyncStatus_Success) {
+        pipeline_cache_insert(reload->pendingCache,&reload->pendingKeys[index],pipeline);
+    } else {
+        fprintf(stderr,"Shader reload: pipeline variant %zu failed: %.*s\n",index,(int)message.length,message.data);
+        if (pipeline) {
+            wgpuRenderPipelineRelease(pipeline);
+        }
+        reload->failed = true;
+    }
+    reload->outstanding--;
+}
+
+static void begin_reload(ShaderReload* reload, const PipelineCache* live, const std::vector<ScenePipelineKey>& keys,
+                         const std::string& source) {
+    reload->startTime = std::chrono::steady_clock::now();
+
+    // A WGSL error makes an invalid module, and every pipeline made from it
+    // fails below. The error scope keeps that from looking like a crash.
+    wgpuDevicePushErrorScope(reload->device,WGPUErrorFilter_Validation);
+    WGPUShaderModule module = create_shader_module(reload->device,source,"Render shader (reloaded)");
+    pop_error_scope(reload->device);
+
+    WGPUCompilationInfoCallbackInfo infoCallback = {};
+    infoCallback.nextInChain = nullptr;
+    infoCallback.mode = WGPUCallbackMode_AllowProcessEvents;
+    infoCallback.callback = &compilation_info_callback;
+    infoCallback.userdata1 = reload;
+    wgpuShaderModuleGetCompilationInfo(module,infoCallback);
+
+    // Same layout, new module. The live cache is untouched until the swap.
+    reload->pendingCache = new PipelineCache();
+    pipeline_cache_init(reload->pendingCache,reload->device,live->layout,module);
+    wgpuShaderModuleRelease(module);
+
+    reload->pendingKeys = keys;
+    reload->outstanding = (uint32_t)keys.size();
+    reload->failed = false;
+    for (size_t i = 0; i < keys.size(); i++) {
+        WGPUCreateRenderPipelineAsyncCallbackInfo callbackInfo = {};
+        callbackInfo.nextInChain = nullptr;
+        callbackInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+        callbackInfo.callback = &pipeline_ready_callback;
+        callbackInfo.userdata1 = reload;
+        callbackInfo.userdata2 = (void*)i;
+        pipeline_cache_create_async(reload->pendingCache,&reload->pendingKeys[i],callbackInfo);
+    }
+}
+
+static PipelineCache* finish_reload(ShaderReload* reload) {
+    PipelineCache* cache = reload->pendingCache;
+    reload->pendingCache = nullptr;
+    std::chrono::duration<double,std::milli> elapsed = std::chrono::steady_clock::now() - reload->startTime;
+
+    if (reload->failed) {
+        reload->failures++;
+        fprintf(stderr,"Shader reload failed after %.1f ms, keeping the last good pipelines\n",elapsed.count());
+        pipeline_cache_release(cache);
+        delete cache;
+        return nullptr;
+    }
+
+    reload->reloads++;
+    printf("Shader reload %u: %zu pipeline variants swapped in after %.1f ms\n",
+        reload->reloads, reload->pendingKeys.size(), elapsed.count());
+    return cache;
+}
+
+PipelineCache* shader_reload_poll(ShaderReload* reload, const PipelineCache* live, const std::vector<ScenePipelineKey>& keys) {
+    if (reload->pendingCache) {
+        return reload->outstanding == 0 ? finish_reload(reload) : nullptr;
+    }
+
+    std::string source;
+    {
+        std::lock_guard<std::mutex> lock(reload->sourceMutex);
+        if (!reload->sourceReady) {
+            return nullptr;
+        }
+        source = std::move(reload->source);
+        reload->fileLines = reload->sourceLines;
+        reload->sourceReady = false;
+    }
+    begin_reload(reload,live,keys,source);
+    return nullptr;
+}
+
+void shader_reload_stop(ShaderReload* reload) {
+    reload->stop = true;
+    if (reload->watcher.joinable()) {
+        reload->watcher.join();
+    }
+    if (reload->inotifyFd >= 0) {
+        close(reload->inotifyFd);
+        reload->inotifyFd = -1;
+    }
+
+    // The async callbacks point at reload, let them finish first
+    if (reload->pendingCache) {
+        while (reload->outstanding > 0) {
+            wgpuInstanceProcessEvents(reload->instance);
+#ifdef WEBGPU_BACKEND_DAWN
+            wgpuDeviceTick(reload->device);
+#endif
+#ifdef WEBGPU_BACKEND_WGPU
+            wgpuDevicePoll(reload->device, false, nullptr);
+#endif
+        }
+        pipeline_cache_release(reload->pendingCache);
+        delete reload->pendingCache;
+        reload->pendingCache = nullptr;
+    }
+    printf("Shader reloads: %u succeeded, %u failed\n",reload->reloads,reload->failures);
+}
@@ -0,0 +1,71 @@
+#ifndef SIMPLE_WEBGPU_SHADER_RELOAD_H
+#define SIMPLE_WEBGPU_SHADER_RELOAD_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <webgpu/webgpu.h>
+#include "shader_variants.h"
+
+// Wait this long after the last write before recompiling, so an editor
+// saving through a temp file and a rename only triggers one reload
+#define SHADER_RELOAD_DEBOUNCE_MS 150
+
+// Recompiles the render shader when one of its source files changes. A
+// background thread watches the files with inotify and reads them once
+// they settle. The main thread then compiles every pipeline variant in use
+// with async pipeline creation, and only swaps them in once all of them
+// succeeded. On any error the old pipelines keep running.
+typedef struct ShaderReload {
+    std::vector<std::string> paths; // concatenated in this order into one module
+    // The first fixedCount paths are read once at start and not watched.
+    // They are shared with shaders a reload doesn't rebuild, so picking up
+    // an edit to them would leave those out of sync.
+    size_t fixedCount;
+    std::vector<std::string> fixedSources;
+    WGPUInstance instance;
+    WGPUDevice device;
+
+    // Watcher thread
+    int inotifyFd;
+    std::vector<int> watchIds; // watch on the directory of each path after the fixed ones
+    std::thread watcher;
+    std::atomic<bool> stop;
+
+    // Source read by the watcher, waiting for the main thread
+    std::mutex sourceMutex;
+    bool sourceReady;
+    std::string source;
+    std::vector<uint32_t> sourceLines; // line count of each file
+
+    // Reload in flight, only touched on the main thread
+    PipelineCache* pendingCache;
+    std::vector<ScenePipelineKey> pendingKeys;
+    std::vector<uint32_t> fileLines; // maps compiler messages back to file:line
+    uint32_t outstanding;            // async pipelines not back yet
+    bool failed;
+    std::chrono::steady_clock::time_point startTime;
+
+    uint32_t reloads;
+    uint32_t failures;
+} ShaderReload;
+
+// Start watching paths, except the first fixedCount. Returns false (and
+// leaves hot reload off) when the platform has no inotify or the files
+// can't be read or watched.
+bool shader_reload_start(ShaderReload* reload, WGPUInstance instance, WGPUDevice device, const std::vector<std::string>& paths,
+                         size_t fixedCount);
+
+// Call once per frame. Starts a recompile of keys when the sources changed,
+// and returns a new cache holding all of them once every variant compiled.
+// The caller owns the returned cache and should drop the live one.
+PipelineCache* shader_reload_poll(ShaderReload* reload, const PipelineCache* live, const std::vector<ScenePipelineKey>& keys);
+
+// Stops the watcher and waits for a reload still compiling
+void shader_reload_stop(ShaderReload* reload);
+
+#endif // SIMPLE_WEBGPU_SHADER_RELOAD_H
@@ -0,0 +1,223 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "shader_variants.h"
+#include "webgpu_utils.h"
+
+// Transform constants plus the fs_main feature switches
+#define SCENE_CONSTANT_COUNT (TRANSFORM_CONSTANT_COUNT + 6)
+
+static void set_constant(WGPUConstantEntry* entry, const char* name, double value) {
+    entry->nextInChain = nullptr;
+    entry->key = {name,WGPU_STRLEN};
+    entry->value = value;
+}
+
+void transform_constant_entries(const TransformConstants* transform, WGPUConstantEntry entries[TRANSFORM_CONSTANT_COUNT]) {
+    set_constant(&entries[0],"TILT",transform->tilt);
+    set_constant(&entries[1],"ASPECT",transform->aspect);
+    set_constant(&entries[2],"REVERSE_Z",transform->reverseZ);
+}
+
+void scene_pipeline_key_init(ScenePipelineKey* key) {
+    memset(key,0,sizeof(ScenePipelineKey));
+}
+
+// FNV-1a over the key bytes
+static uint64_t hash_key(const ScenePipelineKey* key) {
+    const uint8_t* bytes = (const uint8_t*)key;
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < sizeof(ScenePipelineKey); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// A depth-only pipeline has no fragment stage, so the fragment switches
+// and color format don't make it a different variant
+static ScenePipelineKey normalize_key(const ScenePipelineKey* requested) {
+    ScenePipelineKey key = *requested;
+    if (key.depthOnly) {
+        key.features = 0;
+        key.uniformBranching = 0;
+        key.clusteredLights = 0;
+        key.colorFormat = WGPUTextureFormat_Undefined;
+    }
+    return key;
+}
+
+// Render pipeline drawing the culled instances, specialized for one variant.
+// With asyncInfo the pipeline is compiled in the background and handed to
+// its callback instead, and nullptr is returned.
+static WGPURenderPipeline create_scene_pipeline(const PipelineCache* cache, const ScenePipelineKey* key,
+                                                const WGPUCreateRenderPipelineAsyncCallbackInfo* asyncInfo) {
+    WGPURenderPipelineDescriptor renderDesc = {};
+    renderDesc.label = {key->depthOnly ? "depth-prepass-pipeline" : "particle-render-pipeline",WGPU_STRLEN};
+
+    renderDesc.vertex.module = cache->module;
+    renderDesc.vertex.entryPoint = {"vs_main",WGPU_STRLEN};
+
+    // How our vertex data is stored in the buffer
+    WGPUVertexBufferLayout vertexBufLayout = {};
+    vertexBufLayout.arrayStride = sizeof(float) * 3; // 3 floats per vertex
+    vertexBufLayout.nextInChain = nullptr;
+    vertexBufLayout.attributeCount = 1;
+    vertexBufLayout.stepMode = WGPUVertexStepMode_Vertex;
+
+    WGPUVertexAttribute vertexAttr;
+    vertexAttr.format = WGPUVertexFormat_Float32x3;
+    vertexAttr.offset = 0;
+    vertexAttr.nextInChain = nullptr;
+    vertexAttr.shaderLocation = 0; // corresponds to @location(0) in the shader
+    vertexBufLayout.attributes = &vertexAttr;
+
+    renderDesc.layout = cache->layout;
+    renderDesc.vertex.bufferCount = 1;
+    renderDesc.vertex.buffers = &vertexBufLayout;
+    // Each stage only gets the overrides it references, which Dawn insists on:
+    // [TILT, ASPECT, REVERSE_Z] for vs_main, [REVERSE_Z, FEATURE_*, UNIFORM_BRANCHING, CLUSTERED_LIGHTS] for fs_main
+    WGPUConstantEntry constants[SCENE_CONSTANT_COUNT];
+    transform_constant_entries(&key->transform,constants);
+    set_constant(&constants[TRANSFORM_CONSTANT_COUNT + 0],"FEATURE_LIGHTING",(key->features & SHADER_FEATURE_LIGHTING) != 0);
+    set_constant(&constants[TRANSFORM_CONSTANT_COUNT + 1],"FEATURE_FOG",(key->features & SHADER_FEATURE_FOG) != 0);
+    set_constant(&constants[TRANSFORM_CONSTANT_COUNT + 2],"FEATURE_TEXTURE",(key->features & SHADER_FEATURE_TEXTURE) != 0);
+    set_constant(&constants[TRANSFORM_CONSTANT_COUNT + 3],"FEATURE_LIGHTS",(key->features & SHADER_FEATURE_LIGHTS) != 0);
+    set_constant(&constants[TRANSFORM_CONSTANT_COUNT + 4],"UNIFORM_BRANCHING",key->uniformBranching);
+    set_constant(&constants[TRANSFORM_CONSTANT_COUNT + 5],"CLUSTERED_LIGHTS",key->clusteredLights);
+    renderDesc.vertex.constantCount = TRANSFORM_CONSTANT_COUNT;
+    renderDesc.vertex.constants = constants;
+
+    WGPUFragmentState fragment = {};
+    fragment.module = cache->module;
+    fragment.entryPoint = {"fs_main",WGPU_STRLEN};
+    fragment.constantCount = SCENE_CONSTANT_COUNT - (TRANSFORM_CONSTANT_COUNT - 1);
+    fragment.constants = &constants[TRANSFORM_CONSTANT_COUNT - 1];
+    renderDesc.fragment = &fragment;
+
+    WGPUBlendState blendState = {};
+    blendState.color.srcFactor = WGPUBlendFactor_SrcAlpha;
+    blendState.color.dstFactor = WGPUBlendFactor_OneMinusSrcAlpha;
+    blendState.color.operation = WGPUBlendOperation_Add;
+
+    blendState.alpha.srcFactor = WGPUBlendFactor_Zero;
+    blendState.alpha.dstFactor = WGPUBlendFactor_One;
+    blendState.alpha.operation = WGPUBlendOperation_Add;
+    
+    WGPUColorTargetState colorTarget = {};
+    colorTarget.format = key->colorFormat;
+    colorTarget.blend = &blendState;
+    colorTarget.writeMask = WGPUColorWriteMask_All;
+    fragment.targetCount = 1;
+    fragment.targets = &colorTarget;
+
+    // A depth-only pipeline needs no fragment shader at all
+    if (key->depthOnly) {
+        renderDesc.fragment = nullptr;
+    }
+    renderDesc.primitive.topology = WGPUPrimitiveTopology_TriangleList;
+
+    // Depth stencil is necessary to figure out which fragments are drawn in 3D
+    // This configuration is taken from https://eliemichel.github.io/LearnWebGPU/basic-3d-rendering/3d-meshes/depth-buffer.html
+    WGPUDepthStencilState depthStencilState = {};
+    setDefault(depthStencilState);
+
+    // Blend fragment only if depth passes against the current Z buffer
+    // (Less normally, Greater with reverse-Z, Equal after a depth pre-pass)
+    depthStencilState.depthCompare = key->depthCompare;
+    // Update depth in Z buffer once fragment is drawn
+    depthStencilState.depthWriteEnabled = key->depthWrite ? WGPUOptionalBool_True : WGPUOptionalBool_False;
+    depthStencilState.format = key->depthFormat;
+    depthStencilState.stencilReadMask = 0;
+    depthStencilState.stencilWriteMask = 0;
+    renderDesc.depthStencil = &depthStencilState;
+
+    renderDesc.primitive.stripIndexFormat = WGPUIndexFormat_Undefined;
+    renderDesc.primitive.frontFace = WGPUFrontFace_CCW;
+    renderDesc.primitive.cullMode = WGPUCullMode_None;
+    renderDesc.multisample.count = 1;
+    renderDesc.multisample.mask = ~0u;
+    renderDesc.multisample.alphaToCoverageEnabled = false;
+
+    if (asyncInfo) {
+        wgpuDeviceCreateRenderPipelineAsync(cache->device,&renderDesc,*asyncInfo);
+        return nullptr;
+    }
+    return wgpuDeviceCreateRenderPipeline(cache->device,&renderDesc);
+}
+
+void pipeline_cache_init(PipelineCache* cache, WGPUDevice device, WGPUPipelineLayout layout, WGPUShaderModule module) {
+    cache->device = device;
+    cache->layout = layout;
+    cache->module = module;
+    wgpuPipelineLayoutAddRef(layout);
+    wgpuShaderModuleAddRef(module);
+    cache->entries.clear();
+    cache->variantCount = 0;
+    cache->hits = 0;
+    cache->totalCreateMs = 0.0;
+}
+
+WGPURenderPipeline pipeline_cache_get(PipelineCache* cache, const ScenePipelineKey* requested) {
+    ScenePipelineKey key = normalize_key(requested);
+    uint64_t hash = hash_key(&key);
+    std::vector<PipelineCacheEntry>& bucket = cache->entries[hash];
+    for (const PipelineCacheEntry& entry : bucket) {
+        if (memcmp(&entry.key,&key,sizeof(ScenePipelineKey)) == 0) {
+            cache->hits++;
+            return entry.pipeline;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    WGPURenderPipeline pipeline = create_scene_pipeline(cache,&key,nullptr);
+    std::chrono::duration<double,std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    cache->variantCount++;
+    cache->totalCreateMs += elapsed.count();
+    printf("Created pipeline variant %016llx (features 0x%x%s%s%s) in %.2f ms\n",
+        (unsigned long long)hash, key.features,
+        key.depthOnly ? ", depth only" : "",
+        key.uniformBranching ? ", uniform branching" : "",
+        key.clusteredLights ? ", clustered lights" : "",
+        elapsed.count());
+
+    bucket.push_back({key, pipeline});
+    return pipeline;
+}
+
+void pipeline_cache_create_async(const PipelineCache* cache, const ScenePipelineKey* requested,
+                                 WGPUCreateRenderPipelineAsyncCallbackInfo callbackInfo) {
+    ScenePipelineKey key = normalize_key(requested);
+    create_scene_pipeline(cache,&key,&callbackInfo);
+}
+
+void pipeline_cache_insert(PipelineCache* cache, const ScenePipelineKey* requested, WGPURenderPipeline pipeline) {
+    ScenePipelineKey key = normalize_key(requested);
+    std::vector<PipelineCacheEntry>& bucket = cache->entries[hash_key(&key)];
+    for (PipelineCacheEntry& entry : bucket) {
+        if (memcmp(&entry.key,&key,sizeof(ScenePipelineKey)) == 0) {
+            wgpuRenderPipelineRelease(entry.pipeline);
+            entry.pipeline = pipeline;
+            return;
+        }
+    }
+    cache->variantCount++;
+    bucket.push_back({key, pipeline});
+}
+
+void pipeline_cache_report(const PipelineCache* cache) {
+    printf("Pipeline cache: %u variants, %u cache hits, %.2f ms spent creating pipelines\n",
+        cache->variantCount, cache->hits, cache->totalCreateMs);
+}
+
+void pipeline_cache_release(PipelineCache* cache) {
+    for (auto& bucket : cache->entries) {
+        for (PipelineCacheEntry& entry : bucket.second) {
+            wgpuRenderPipelineRelease(entry.pipeline);
+        }
+    }
+    cache->entries.clear();
+    wgpuPipelineLayoutRelease(cache->layout);
+    wgpuShaderModuleRelease(cache->module);
+}
@@ -0,0 +1,81 @@
+#ifndef SIMPLE_WEBGPU_SHADER_VARIANTS_H
+#define SIMPLE_WEBGPU_SHADER_VARIANTS_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <webgpu/webgpu.h>
+
+// Optional fs_main features. Each one maps to an override constant in
+// simple_shader.wgsl, so a pipeline only contains the paths it uses.
+#define SHADER_FEATURE_LIGHTING (1u << 0) // FEATURE_LIGHTING: flat Lambert shading
+#define SHADER_FEATURE_FOG      (1u << 1) // FEATURE_FOG: fade to the clear color with depth
+#define SHADER_FEATURE_TEXTURE  (1u << 2) // FEATURE_TEXTURE: modulate by the streamed texture
+#define SHADER_FEATURE_LIGHTS   (1u << 3) // FEATURE_LIGHTS: point and spot lights (clustered_lighting.h)
+
+// Values for the override constants in transform.wgsl. Every pipeline whose
+// shader includes that file has to be specialized with the same values.
+typedef struct TransformConstants {
+    float tilt;        // TILT: rotation around x in radians
+    float aspect;      // ASPECT: framebuffer width / height
+    uint32_t reverseZ; // REVERSE_Z
+} TransformConstants;
+
+#define TRANSFORM_CONSTANT_COUNT 3
+
+// Fill the constant entries for TransformConstants, in the order TILT, ASPECT,
+// REVERSE_Z. Entry points that only use farther() just take the last one.
+void transform_constant_entries(const TransformConstants* transform, WGPUConstantEntry entries[TRANSFORM_CONSTANT_COUNT]);
+
+// Everything that makes one scene pipeline different from another. Always
+// start from scene_pipeline_key_init() so padding bytes hash the same.
+typedef struct ScenePipelineKey {
+    uint32_t features;         // SHADER_FEATURE_* bits
+    uint32_t uniformBranching; // read the features from the uniform buffer at runtime instead
+    uint32_t clusteredLights;  // FEATURE_LIGHTS only shades the lights of the fragment's cluster
+    uint32_t depthOnly;        // no fragment stage, for the depth pre-pass
+    uint32_t depthWrite;
+    WGPUCompareFunction depthCompare;
+    WGPUTextureFormat colorFormat;
+    WGPUTextureFormat depthFormat;
+    TransformConstants transform;
+} ScenePipelineKey;
+
+void scene_pipeline_key_init(ScenePipelineKey* key);
+
+typedef struct PipelineCacheEntry {
+    ScenePipelineKey key;
+    WGPURenderPipeline pipeline;
+} PipelineCacheEntry;
+
+// Scene pipelines keyed by a hash of ScenePipelineKey, so asking for the same
+// variant twice returns the same pipeline instead of compiling it again
+typedef struct PipelineCache {
+    WGPUDevice device;
+    WGPUPipelineLayout layout;
+    WGPUShaderModule module;
+    std::unordered_map<uint64_t, std::vector<PipelineCacheEntry>> entries;
+
+    uint32_t variantCount;
+    uint32_t hits;
+    double totalCreateMs;
+} PipelineCache;
+
+// The cache keeps its own references to the layout and module
+void pipeline_cache_init(PipelineCache* cache, WGPUDevice device, WGPUPipelineLayout layout, WGPUShaderModule module);
+
+// Returns a pipeline owned by the cache
+WGPURenderPipeline pipeline_cache_get(PipelineCache* cache, const ScenePipelineKey* key);
+
+// Compile a variant in the background. The callback gets the pipeline (or
+// the error), and pipeline_cache_insert() can hand it to a cache afterwards.
+void pipeline_cache_create_async(const PipelineCache* cache, const ScenePipelineKey* key,
+                                 WGPUCreateRenderPipelineAsyncCallbackInfo callbackInfo);
+
+// The cache takes over the reference to pipeline
+void pipeline_cache_insert(PipelineCache* cache, const ScenePipelineKey* key, WGPURenderPipeline pipeline);
+
+void pipeline_cache_report(const PipelineCache* cache);
+void pipeline_cache_release(PipelineCache* cache);
+
+#endif // SIMPLE_WEBGPU_SHADER_VARIANTS_H
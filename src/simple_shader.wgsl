@@ -1,43 +1,172 @@
+// Expects transform.wgsl to be prepended (provides project())
+
+// fs_main features, specialized per pipeline (SHADER_FEATURE_* in
+// shader_variants.h). A disabled feature is a constant false branch that the
+// compiler drops.
+override FEATURE_LIGHTING: bool = false;
+override FEATURE_FOG: bool = false;
+override FEATURE_TEXTURE: bool = false;
+override FEATURE_LIGHTS: bool = false;
+// Baseline for benchmarking: ignore the constants above and branch on
+// transformBuffer.featureFlags at runtime instead
+override UNIFORM_BRANCHING: bool = false;
+// FEATURE_LIGHTS shades only the lights binned into the fragment's cluster
+// instead of looping over all of them
+override CLUSTERED_LIGHTS: bool = true;
+
 struct VertexIn {
 	@location(0) pos: vec3f,
 };
 
 struct VertexOut {
-	@builtin(position) pos: vec4f,
+	// Invariant so the depth pre-pass and the Equal color pass get bit-identical depth
+	@builtin(position) @invariant pos: vec4f,
 	@location(0) color: vec3f,
+	@location(1) objectPos: vec3f,
+	@location(2) @interpolate(flat) uvScale: f32,
 };
 
 struct Transforms {
     tf1: mat4x4<f32>,
     tf2: mat4x4<f32>,
+    // SHADER_FEATURE_* bits in x, only read with UNIFORM_BRANCHING
+    featureFlags: vec4u,
+    // Cursor in [-1, 1] from the input thread, steers the light in xy
+    pointer: vec4f,
+};
+
+// Must match InstanceData in hiz_culling.h
+struct Instance {
+    center: vec4f,
+    extent: vec4f,
+    color: vec4f,
 };
 
 //@group(0) @binding(0) var<uniform> pointBuffer: array<f32>;
 //@group(0) @binding(1) var<uniform> indexBuffer: array<i32>;
 @group(0) @binding(0) var<uniform> transformBuffer: Transforms;
+@group(0) @binding(1) var<storage, read> instances: array<Instance>;
+// Written by the culling pass: which instances survived, packed at the front.
+// The materials scene uploads its sorted draw order here instead.
+@group(0) @binding(2) var<storage, read> visibleIds: array<u32>;
+// Whatever part of the active texture is resident (texture_streaming.h)
+@group(0) @binding(3) var materialTexture: texture_2d<f32>;
+@group(0) @binding(4) var materialSampler: sampler;
+
+// Must match MaterialData in materials.h
+struct Material {
+	color: vec4f,
+	uvScale: f32,
+	features: u32,    // what the pipeline was picked by, not read here
+	textureSlot: u32, // what the bind group was picked by, not read here
+	padding: u32,
+};
+
+// Every material, and which one each instance uses (materials.h)
+@group(0) @binding(5) var<storage, read> materials: array<Material>;
+@group(0) @binding(6) var<storage, read> instanceMaterials: array<u32>;
+
+// Must match LightData in clustered_lighting.h
+struct Light {
+	position: vec4f,  // xyz, w range
+	color: vec4f,
+	direction: vec4f, // spot axis, w cos of the cone angle (-1 for point lights)
+	motion: vec4f,
+};
+
+// Must match ClusterParams in clustered_lighting.h
+struct ClusterParams {
+	gridSize: vec3u,
+	lightCount: u32,
+	screenSize: vec2f,
+	time: f32,
+	indexCapacity: u32,
+};
+
+// Built by cluster_lights.wgsl earlier in the frame
+@group(1) @binding(0) var<uniform> clusterParams: ClusterParams;
+@group(1) @binding(1) var<storage, read> lights: array<Light>;
+@group(1) @binding(2) var<storage, read> clusters: array<vec2u>;
+@group(1) @binding(3) var<storage, read> lightIndices: array<u32>;
+
+// Must match ViewData in multi_view.h
+struct View {
+	camera: mat4x4f,
+};
+
+// The camera this draw renders from, picked with a dynamic offset. Identity
+// for the window, one per texture array layer in batch mode.
+@group(2) @binding(0) var<storage, read> sceneView: View;
 
 @vertex
-fn vs_main(in: VertexIn) -> VertexOut {
+fn vs_main(in: VertexIn, @builtin(instance_index) instanceIndex: u32) -> VertexOut {
     var out: VertexOut;
-	let ratio = 640.0 / 480.0;
-	var offset = vec2f(0.0);
-
-    let angle = 0.5;
-    let alpha = cos(angle);
-	let beta = sin(angle);
-	var pos = vec3f(
-		in.pos.x,
-		alpha * in.pos.y + beta * in.pos.z,
-		alpha * in.pos.z - beta * in.pos.y,
-	);
-	out.pos = vec4f(pos.x, pos.y * ratio, pos.z * 0.5 + 0.5, 1.0);	
-
-	out.color = vec3f(0.9, 0.8, 0.2);
+    let id = visibleIds[instanceIndex];
+    let inst = instances[id];
+    let material = materials[instanceMaterials[id]];
+
+	out.objectPos = inst.center.xyz + in.pos * inst.extent.xyz;
+	// Shading stays in object space, only the projection depends on the view
+	out.pos = project((sceneView.camera * vec4f(out.objectPos, 1.0)).xyz);
+	out.color = inst.color.rgb * material.color.rgb;
+	out.uvScale = material.uvScale;
 	return out;
 }
 
+fn feature_enabled(specialized: bool, bit: u32) -> bool {
+	if (UNIFORM_BRANCHING) {
+		return (transformBuffer.featureFlags.x & bit) != 0u;
+	}
+	return specialized;
+}
+
+fn shade_light(light: Light, position: vec3f, normal: vec3f) -> vec3f {
+	let toLight = light.position.xyz - position;
+	let distance = length(toLight);
+	let direction = toLight / max(distance, 1e-4);
+	var falloff = saturate(1.0 - distance / light.position.w);
+	falloff *= falloff;
+	let cone = light.direction.w;
+	let spot = select(smoothstep(cone, mix(cone, 1.0, 0.2), dot(-direction, light.direction.xyz)), 1.0, cone <= -1.0);
+	return light.color.rgb * falloff * spot * abs(dot(normal, direction));
+}
+
 @fragment
 fn fs_main(in: VertexOut) -> @location(0) vec4f {
-	let color: vec3<f32> = in.color;
+	var color: vec3<f32> = in.color;
+	if (feature_enabled(FEATURE_TEXTURE, 4u)) {
+		// Planar mapping, skewed by z so no cube face gets a constant uv
+		let uv = (in.objectPos.xy + in.objectPos.zz) * 2.0 * in.uvScale;
+		color *= textureSample(materialTexture, materialSampler, uv).rgb;
+	}
+	if (feature_enabled(FEATURE_LIGHTING, 1u)) {
+		// Flat normal from how the surface position changes across the screen
+		let normal = normalize(cross(dpdx(in.objectPos), dpdy(in.objectPos)));
+		let lightDir = normalize(vec3f(transformBuffer.pointer.xy, -0.5));
+		color *= 0.3 + 0.7 * abs(dot(normal, lightDir));
+	}
+	if (feature_enabled(FEATURE_LIGHTS, 8u)) {
+		let normal = normalize(cross(dpdx(in.objectPos), dpdy(in.objectPos)));
+		var lit = vec3f(0.15);
+		if (CLUSTERED_LIGHTS) {
+			// Same depth the clusters were sliced by (see fog below)
+			let grid = clusterParams.gridSize;
+			let linearDepth = select(in.pos.z, 1.0 - in.pos.z, REVERSE_Z);
+			let cell = min(vec3u(vec3f(in.pos.xy / clusterParams.screenSize, linearDepth) * vec3f(grid)), grid - vec3u(1u));
+			let list = clusters[cell.x + grid.x * (cell.y + grid.y * cell.z)];
+			for (var i = 0u; i < list.y; i++) {
+				lit += shade_light(lights[lightIndices[list.x + i]], in.objectPos, normal);
+			}
+		} else {
+			for (var i = 0u; i < clusterParams.lightCount; i++) {
+				lit += shade_light(lights[i], in.objectPos, normal);
+			}
+		}
+		color *= lit;
+	}
+	if (feature_enabled(FEATURE_FOG, 2u)) {
+		let distance = select(in.pos.z, 1.0 - in.pos.z, REVERSE_Z);
+		color = mix(color, vec3f(0.0, 0.6, 0.9), distance * distance);
+	}
 	return vec4f(color, 1.0);
-}
\ No newline at end of file
+}
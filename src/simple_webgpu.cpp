@@ -3,16 +3,45 @@
 #include <cstdarg>
 #include <cstdint>
 #include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <cmath>
 #include <fstream>
 #include <sstream>
+#include <atomic>
 #include <chrono>
 #include <thread>
+#include <vector>
 #include <unistd.h>
 #include <webgpu/webgpu.h>
 #include <GLFW/glfw3.h>
 #include <glfw3webgpu.h>
+#include "webgpu_utils.h"
+#include "hiz_culling.h"
+#include "frame_stats.h"
+#include "render_options.h"
+#include "shader_variants.h"
+#include "shader_reload.h"
+#include "input_thread.h"
+#include "gpu_resources.h"
+#include "texture_streaming.h"
+#include "clustered_lighting.h"
+#include "multi_view.h"
+#include "adapter_selection.h"
+#include "bind_group_cache.h"
+#include "materials.h"
+
+// Rotation of the scene around x (TILT in transform.wgsl)
+#define SCENE_TILT 0.5f
+
+// Sources of the render shader, concatenated in this order. project() lives
+// in its own file so the culling shader can share it.
+static const std::vector<std::string> renderShaderPaths = {"src/transform.wgsl", "src/simple_shader.wgsl"};
+// Hot reload leaves transform.wgsl as it was at startup. The culling, light
+// binning and multi-view compute shaders include it as well and aren't
+// rebuilt, so they would disagree with the renderer about where things land.
+#define RENDER_SHADER_FIXED_PATHS 1
 
 typedef struct SurfaceViewData {
     WGPUSurfaceTexture surfaceTexture;
@@ -23,25 +52,60 @@ typedef struct CoordTransform {
     float coords[16];
 } CoordTransform;
 
+// Tail of the Transforms uniform after the two matrices
+typedef struct FeatureFlags {
+    uint32_t flags[4]; // SHADER_FEATURE_* bits in [0]
+} FeatureFlags;
+
+// Last field of the Transforms uniform, rewritten whenever input arrives
+typedef struct PointerState {
+    float position[4]; // cursor in [-1, 1] in xy
+} PointerState;
+
+// Matches Transforms in simple_shader.wgsl
+typedef struct TransformUniform {
+    CoordTransform object;
+    CoordTransform light;
+    FeatureFlags features;
+    PointerState pointer;
+} TransformUniform;
+
+#define POINTER_STATE_OFFSET offsetof(TransformUniform,pointer)
+
+// The handles release themselves, release_buffers() just makes sure that
+// happens before the device goes away. The bind groups belong to
+// bindGroupCache and are looked up again every frame.
 typedef struct PipelineSetupOutput {
-    WGPUBuffer pointBuffer;
-    WGPUBuffer indexBuffer;
-    WGPUBuffer transformBuffer;
-    WGPUBindGroup bindGroup;
-    WGPURenderPipeline renderPipeline;
-    WGPUTexture depthTexture;
-    WGPUTextureView depthTextureView;
+    BufferHandle pointBuffer;
+    BufferHandle indexBuffer;
+    BufferHandle transformBuffer;
+    BindGroupLayoutHandle bindGroupLayout;
+    BindGroupCache* bindGroupCache;
+    WGPUBindGroup earlyBindGroup; // draws the early visible list
+    WGPUBindGroup lateBindGroup;  // draws the late visible list
+    WGPUBindGroup batchBindGroup; // draws the list shared by the batch views
+    WGPURenderPipeline renderPipeline;       // owned by pipelineCache
+    WGPURenderPipeline depthPrepassPipeline; // nullptr unless options.depthPrepass
+    WGPURenderPipeline batchPipeline;        // nullptr unless options.batchViews
+    PipelineCache* pipelineCache;
+    ScenePipelineKey colorKey; // variants in use, recompiled on shader reload
+    ScenePipelineKey depthKey;
+    ScenePipelineKey batchKey;
+    ScenePipelineKey materialKey; // features get each material's added (update_material_pipelines)
+    TextureHandle depthTexture;
+    TextureViewHandle depthTextureView;
+    HiZCulling culling;
+    ClusteredLighting lighting;
+    MultiView views;
+    MaterialSystem materials;
+    FrameStats frameStats;
+    TextureStreamer* textures;      // sampled with FEATURE_TEXTURE
+    uint32_t activeTexture;         // index into textures, cycled with T
+    RenderOptions options;
     uint32_t height;
     uint32_t width;
 } PipelineSetupOutput;
 
-void error_callback(WGPUPopErrorScopeStatus status, WGPUErrorType type, WGPUStringView message, void* userdata1, void* userdata2) {
-    // Handle the error scope result here
-    if (message.length > 0) {
-        printf("Status: %d, Error type: %d, Message: %.*s\n", (int)status, (int)type, (int)message.length, message.data);
-    }
-}
-
 static void on_uncaptured_error(const WGPUDevice* device, WGPUErrorType type, WGPUStringView msg, void*, void*) {
   fprintf(stderr, "UNCAPTURED %d: %.*s\n", (int)type, (int)msg.length, msg.data);
 }
@@ -49,58 +113,423 @@ static void on_device_lost(const WGPUDevice* device, WGPUDeviceLostReason reason
   fprintf(stderr, "DEVICE LOST %d: %.*s\n", (int)reason, (int)msg.length, msg.data);
 }
 
-void setDefault(WGPUStencilFaceState &stencilFaceState) {
-    stencilFaceState.compare = WGPUCompareFunction_Always;
-    stencilFaceState.failOp = WGPUStencilOperation_Keep;
-    stencilFaceState.depthFailOp = WGPUStencilOperation_Keep;
-    stencilFaceState.passOp = WGPUStencilOperation_Keep;
+// Scene generators draw from a fixed seed so benchmark runs are comparable.
+// Returns a number in [0, 1) and advances the seed.
+static float random01(uint32_t* seed) {
+    *seed = *seed * 1664525u + 1013904223u;
+    return (float)(*seed >> 8) / (float)(1u << 24);
+}
+
+// Dense test scene for the occlusion culling: a wall close to the camera with
+// a block of small cubes behind it, wider than the wall so the rim stays visible
+std::vector<InstanceData> build_scene() {
+    std::vector<InstanceData> instances;
+
+    // transform.wgsl tilts everything around x. Place things along the
+    // tilted axes so the wall really sits in front of the cubes on screen.
+    const float angle = SCENE_TILT;
+    const float up[3] = {0.0f, cosf(angle), sinf(angle)};
+    const float forward[3] = {0.0f, -sinf(angle), cosf(angle)};
+    auto place = [&](float x, float u, float depth, const float extent[3], const float color[3]) {
+        InstanceData inst = {};
+        inst.center[0] = x;
+        inst.center[1] = u * up[1] + depth * forward[1];
+        inst.center[2] = u * up[2] + depth * forward[2];
+        memcpy(inst.extent,extent,3 * sizeof(float));
+        memcpy(inst.color,color,3 * sizeof(float));
+        inst.color[3] = 1.0f;
+        instances.push_back(inst);
+    };
+
+    const float wallExtent[3] = {0.6f, 0.45f, 0.02f};
+    const float wallColor[3] = {0.9f, 0.8f, 0.2f};
+    place(0.0f, 0.0f, -0.5f, wallExtent, wallColor);
+
+    const float cubeExtent[3] = {0.012f, 0.012f, 0.012f};
+
+    const int grid = 32;
+    const int layers = 4;
+    for (int layer = 0; layer < layers; layer++) {
+        for (int row = 0; row < grid; row++) {
+            for (int col = 0; col < grid; col++) {
+                float x = -0.9f + 1.8f * col / (grid - 1);
+                float u = -0.6f + 1.2f * row / (grid - 1);
+                float depth = 0.1f + 0.6f * layer / (layers - 1);
+                float color[3] = {(float)col / grid, (float)row / grid, 0.3f + 0.2f * layer};
+                place(x, u, depth, cubeExtent, color);
+            }
+        }
+    }
+    return instances;
 }
 
-void setDefault(WGPUDepthStencilState &depthStencilState) {
-    depthStencilState.format = WGPUTextureFormat_Undefined;
-    depthStencilState.depthWriteEnabled = WGPUOptionalBool_False;
-    depthStencilState.depthCompare = WGPUCompareFunction_Always;
-    depthStencilState.stencilReadMask = 0xFFFFFFFF;
-    depthStencilState.stencilWriteMask = 0xFFFFFFFF;
-    depthStencilState.depthBias = 0;
-    depthStencilState.depthBiasSlopeScale = 0;
-    depthStencilState.depthBiasClamp = 0;
-    setDefault(depthStencilState.stencilFront);
-    setDefault(depthStencilState.stencilBack);
+// Overdraw stress scene: large boxes piled on top of each other in random
+// order, so without a depth pre-pass most pixels get shaded many times over.
+// Every box pokes out somewhere, so occlusion culling can't remove them.
+std::vector<InstanceData> build_overdraw_scene() {
+    std::vector<InstanceData> instances;
+    const int count = 400;
+
+    uint32_t seed = 12345;
+
+    for (int i = 0; i < count; i++) {
+        InstanceData inst = {};
+        inst.center[0] = -0.6f + 1.2f * random01(&seed);
+        inst.center[1] = -0.45f + 0.9f * random01(&seed);
+        inst.center[2] = -0.7f + 1.4f * random01(&seed);
+        inst.extent[0] = 0.15f + 0.25f * random01(&seed);
+        inst.extent[1] = 0.1f + 0.2f * random01(&seed);
+        inst.extent[2] = 0.02f;
+        inst.color[0] = random01(&seed);
+        inst.color[1] = random01(&seed);
+        inst.color[2] = random01(&seed);
+        inst.color[3] = 1.0f;
+        instances.push_back(inst);
+    }
+    return instances;
 }
 
-void setDefault(WGPUBindGroupLayoutEntry &bindingLayout) {
-    bindingLayout.buffer.nextInChain = nullptr;
-    bindingLayout.buffer.type = WGPUBufferBindingType_Undefined;
-    bindingLayout.buffer.hasDynamicOffset = false;
+// Material stress scene: a grid of cubes that each get a material of their
+// own, with random features and textures, so drawing them in scene order
+// changes pipeline and bind group almost every cube
+std::vector<InstanceData> build_material_scene(std::vector<MaterialData>* materials, std::vector<uint32_t>* instanceMaterials) {
+    std::vector<InstanceData> instances;
+    const int grid = 100;
+
+    uint32_t seed = 24680;
+
+    for (int row = 0; row < grid; row++) {
+        for (int col = 0; col < grid; col++) {
+            InstanceData inst = {};
+            inst.center[0] = -0.9f + 1.8f * col / (grid - 1);
+            inst.center[1] = -0.6f + 1.2f * row / (grid - 1);
+            inst.center[2] = -0.5f + random01(&seed);
+            inst.extent[0] = 0.007f;
+            inst.extent[1] = 0.005f;
+            inst.extent[2] = 0.007f;
+            // The material supplies the color
+            inst.color[0] = 1.0f;
+            inst.color[1] = 1.0f;
+            inst.color[2] = 1.0f;
+            inst.color[3] = 1.0f;
+            instances.push_back(inst);
+
+            MaterialData material = {};
+            material.color[0] = random01(&seed);
+            material.color[1] = random01(&seed);
+            material.color[2] = random01(&seed);
+            material.color[3] = 1.0f;
+            material.uvScale = 1.0f + 3.0f * random01(&seed);
+            material.features = (uint32_t)(random01(&seed) * MATERIAL_PIPELINE_SLOTS) & MATERIAL_FEATURE_MASK;
+            material.textureSlot = (uint32_t)(random01(&seed) * MATERIAL_TEXTURE_SLOTS);
+            instanceMaterials->push_back((uint32_t)materials->size());
+            materials->push_back(material);
+        }
+    }
+    return instances;
+}
 
-    bindingLayout.sampler.nextInChain = nullptr;
-    bindingLayout.sampler.type = WGPUSamplerBindingType_BindingNotUsed;
+// Lights spread through the scene volume, each circling its start position.
+// Small ranges, so with thousands of them each pixel still only sees a few.
+std::vector<LightData> build_lights(uint32_t count) {
+    std::vector<LightData> lights;
+
+    uint32_t seed = 54321;
+
+    for (uint32_t i = 0; i < count; i++) {
+        LightData light = {};
+        light.position[0] = -1.0f + 2.0f * random01(&seed);
+        light.position[1] = -0.8f + 1.6f * random01(&seed);
+        light.position[2] = -0.8f + 1.6f * random01(&seed);
+        light.position[3] = 0.05f + 0.1f * random01(&seed);
+        light.color[0] = random01(&seed);
+        light.color[1] = random01(&seed);
+        light.color[2] = random01(&seed);
+
+        // Every fourth one is a spot light pointing roughly down
+        light.direction[3] = -1.0f;
+        if (i % 4 == 0) {
+            float dx = 0.6f * (random01(&seed) - 0.5f);
+            float dz = 0.6f * (random01(&seed) - 0.5f);
+            float length = sqrtf(dx * dx + 1.0f + dz * dz);
+            light.direction[0] = dx / length;
+            light.direction[1] = -1.0f / length;
+            light.direction[2] = dz / length;
+            light.direction[3] = 0.8f + 0.15f * random01(&seed);
+        }
 
-    bindingLayout.storageTexture.nextInChain = nullptr;
-    bindingLayout.storageTexture.access = WGPUStorageTextureAccess_BindingNotUsed;
-    bindingLayout.storageTexture.format = WGPUTextureFormat_Undefined;
-    bindingLayout.storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
+        light.motion[0] = 0.05f + 0.15f * random01(&seed);
+        light.motion[1] = 0.5f + random01(&seed);
+        light.motion[2] = 6.2831853f * random01(&seed);
+        lights.push_back(light);
+    }
+    return lights;
+}
 
-    bindingLayout.texture.nextInChain = nullptr;
-    bindingLayout.texture.multisampled = false;
-    bindingLayout.texture.sampleType = WGPUTextureSampleType_BindingNotUsed;
-    bindingLayout.texture.viewDimension = WGPUTextureViewDimension_Undefined;
+// --light-sweep steps through these counts, each clustered and then naive
+static const uint32_t lightSweepCounts[] = {10, 100, 1000, 10000};
+#define LIGHT_SWEEP_STEPS (2 * sizeof(lightSweepCounts) / sizeof(lightSweepCounts[0]))
+
+// Batch mode cameras: the scene turned around the axis that is vertical on
+// screen, spread over 120 degrees, and scaled down so the corners stay
+// inside the depth range
+std::vector<ViewData> build_views(uint32_t count) {
+    std::vector<ViewData> views;
+    const float up[3] = {0.0f, cosf(SCENE_TILT), sinf(SCENE_TILT)};
+    const float scale = 0.8f;
+
+    for (uint32_t i = 0; i < count; i++) {
+        float angle = count > 1 ? -1.0471976f + 2.0943951f * i / (count - 1) : 0.0f;
+        float c = cosf(angle);
+        float s = sinf(angle);
+
+        // Rotation around up (Rodrigues), column-major
+        ViewData view = {};
+        for (int col = 0; col < 3; col++) {
+            for (int row = 0; row < 3; row++) {
+                float value = (1.0f - c) * up[row] * up[col] + (row == col ? c : 0.0f);
+                view.camera[col * 4 + row] = scale * value;
+            }
+        }
+        view.camera[1 * 4 + 2] += scale * s * up[0];
+        view.camera[2 * 4 + 1] -= scale * s * up[0];
+        view.camera[2 * 4 + 0] += scale * s * up[1];
+        view.camera[0 * 4 + 2] -= scale * s * up[1];
+        view.camera[0 * 4 + 1] += scale * s * up[2];
+        view.camera[1 * 4 + 0] -= scale * s * up[2];
+        view.camera[15] = 1.0f;
+        views.push_back(view);
+    }
+    return views;
 }
 
-// Adapted from tutorial, thus why it uses C++ functions instead of fopen()/fgets()
-std::string LoadWGSLShader(const std::string& filepath) {
-    std::ifstream file(filepath);
-    if (!file.is_open()) {
-        throw std::runtime_error("Failed to open shader file: " + filepath);
+RenderOptions parse_render_options(int argc, char** argv) {
+    RenderOptions options = {};
+    options.scene = "occlusion";
+    options.textureBudgetMB = 16;
+    options.lightCount = 1000;
+#ifdef SIMPLE_WEBGPU_BENCHMARK_BUILD
+    // The benchmark executable measures unless told otherwise
+    options.benchmarkFrames = 300;
+#endif
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i],"--depth-prepass") == 0) {
+            options.depthPrepass = true;
+        } else if (strcmp(argv[i],"--reverse-z") == 0) {
+            options.reverseZ = true;
+        } else if (strcmp(argv[i],"--features") == 0 && i + 1 < argc) {
+            // Comma separated list, e.g. --features lighting,fog
+            const char* list = argv[++i];
+            if (strstr(list,"lighting")) {
+                options.shaderFeatures |= SHADER_FEATURE_LIGHTING;
+            }
+            if (strstr(list,"fog")) {
+                options.shaderFeatures |= SHADER_FEATURE_FOG;
+            }
+            if (strstr(list,"texture")) {
+                options.shaderFeatures |= SHADER_FEATURE_TEXTURE;
+            }
+            if (strstr(list,"lights")) {
+                options.shaderFeatures |= SHADER_FEATURE_LIGHTS;
+            }
+        } else if (strcmp(argv[i],"--uniform-branching") == 0) {
+            options.uniformBranching = true;
+        } else if (strcmp(argv[i],"--scene") == 0 && i + 1 < argc) {
+            options.scene = argv[++i];
+        } else if (strcmp(argv[i],"--benchmark") == 0 && i + 1 < argc) {
+            options.benchmarkFrames = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i],"--memory-budget") == 0 && i + 1 < argc) {
+            options.memoryBudgetMB = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i],"--texture") == 0 && i + 1 < argc && options.textureCount < RENDER_MAX_TEXTURES) {
+            options.texturePaths[options.textureCount++] = argv[++i];
+        } else if (strcmp(argv[i],"--texture-budget") == 0 && i + 1 < argc) {
+            options.textureBudgetMB = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i],"--lights") == 0 && i + 1 < argc) {
+            options.lightCount = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i],"--naive-lights") == 0) {
+            options.naiveLights = true;
+        } else if (strcmp(argv[i],"--light-sweep") == 0) {
+            options.lightSweep = true;
+        } else if (strcmp(argv[i],"--views") == 0 && i + 1 < argc) {
+            options.batchViews = (uint32_t)atoi(argv[++i]);
+            if (options.batchViews > MULTI_VIEW_MAX_VIEWS) {
+                options.batchViews = MULTI_VIEW_MAX_VIEWS;
+            }
+        } else if (strcmp(argv[i],"--software-adapter") == 0) {
+            options.softwareAdapter = true;
+        } else if (strcmp(argv[i],"--low-power") == 0) {
+            options.lowPower = true;
+        } else if (strcmp(argv[i],"--unsorted-draws") == 0) {
+            options.unsortedDraws = true;
+        } else {
+            fprintf(stderr,"Unknown option %s\n",argv[i]);
+            fprintf(stderr,"Usage: %s [--depth-prepass] [--reverse-z] [--features lighting,fog,texture,lights] [--uniform-branching] [--scene occlusion|overdraw|materials] [--benchmark frames] [--memory-budget MB] [--texture path]... [--texture-budget MB] [--lights count] [--naive-lights] [--light-sweep] [--views count] [--software-adapter] [--low-power] [--unsorted-draws]\n",argv[0]);
+            exit(1);
+        }
+    }
+
+    // The sweep steps the window's pipeline, batch mode has its own numbers
+    if (options.batchViews > 0) {
+        options.lightSweep = false;
+    }
+
+    // The sweep is a benchmark of the lights, so it needs both
+    if (options.lightSweep) {
+        options.shaderFeatures |= SHADER_FEATURE_LIGHTS;
+        if (options.benchmarkFrames == 0) {
+            options.benchmarkFrames = 100;
+        }
     }
+    return options;
+}
 
-    std::stringstream buffer;
-    buffer << file.rdbuf();  // Read entire file
-    return buffer.str();
+void queue_done_callback(WGPUQueueWorkDoneStatus status, void* userdata1, void* userdata2) {
+    *(bool*)(userdata1) = true;
+}
+
+// Block until the GPU has finished everything submitted so far
+void wait_for_queue(WGPUInstance instance, WGPUDevice device, WGPUQueue queue) {
+    bool done = false;
+    WGPUQueueWorkDoneCallbackInfo doneInfo = {};
+    doneInfo.nextInChain = nullptr;
+    doneInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+    doneInfo.callback = &queue_done_callback;
+    doneInfo.userdata1 = &done;
+    wgpuQueueOnSubmittedWorkDone(queue,doneInfo);
+
+    while (!done) {
+        wgpuInstanceProcessEvents(instance);
+#ifdef WEBGPU_BACKEND_DAWN
+        wgpuDeviceTick(device);
+#endif
+#ifdef WEBGPU_BACKEND_WGPU
+        wgpuDevicePoll(device, false, nullptr);
+#endif
+    }
 }
 
-void create_buffers(PipelineSetupOutput* output, WGPUDevice* device_ptr, WGPUTextureFormat* preferredFormat_ptr) {
+// Look up this frame's scene bind groups. They only differ in the list of
+// instance ids and the streamed texture, and the cache hands back the same
+// bind group as long as neither changed.
+void resolve_scene_bind_groups(PipelineSetupOutput* output) {
+    WGPUBindGroupDescriptor bgDesc = {};
+    bgDesc.entryCount = 7;
+    bgDesc.nextInChain = nullptr;
+    bgDesc.label = {"Bind group",WGPU_STRLEN};
+    bgDesc.layout = output->bindGroupLayout;
+
+    WGPUBindGroupEntry entries[7] = {};
+
+    entries[0].binding = 0;
+    entries[0].buffer = output->transformBuffer;
+    entries[0].offset = 0;
+    entries[0].size = WGPU_WHOLE_SIZE;
+    entries[0].nextInChain = nullptr;
+
+    entries[1].binding = 1;
+    entries[1].buffer = output->culling.instanceBuffer;
+    entries[1].offset = 0;
+    entries[1].size = WGPU_WHOLE_SIZE;
+    entries[1].nextInChain = nullptr;
+
+    entries[2].binding = 2;
+    entries[2].offset = 0;
+    entries[2].size = WGPU_WHOLE_SIZE;
+    entries[2].nextInChain = nullptr;
+
+    entries[3].binding = 3;
+    entries[3].textureView = texture_streamer_view(output->textures,output->activeTexture);
+    entries[3].nextInChain = nullptr;
+
+    entries[4].binding = 4;
+    entries[4].sampler = output->textures->sampler;
+    entries[4].nextInChain = nullptr;
+
+    // Material parameters and the material id of every instance
+    entries[5].binding = 5;
+    entries[5].buffer = output->materials.materialBuffer;
+    entries[5].offset = 0;
+    entries[5].size = WGPU_WHOLE_SIZE;
+    entries[5].nextInChain = nullptr;
+
+    entries[6].binding = 6;
+    entries[6].buffer = output->materials.instanceMaterialBuffer;
+    entries[6].offset = 0;
+    entries[6].size = WGPU_WHOLE_SIZE;
+    entries[6].nextInChain = nullptr;
+
+    // Same layout for every pass, only the list of ids and the texture differ
+    bgDesc.entries = entries;
+    BindGroupCache* cache = output->bindGroupCache;
+    entries[2].buffer = output->culling.earlyListBuffer;
+    output->earlyBindGroup = bind_group_cache_get(cache,&bgDesc);
+    entries[2].buffer = output->culling.lateListBuffer;
+    output->lateBindGroup = bind_group_cache_get(cache,&bgDesc);
+    if (output->views.batch) {
+        entries[2].buffer = output->views.visibleListBuffer;
+        output->batchBindGroup = bind_group_cache_get(cache,&bgDesc);
+    }
+
+    // One per texture the materials sample, all drawing the sorted list
+    if (output->materials.cpuDraws) {
+        entries[2].buffer = output->materials.drawOrderBuffer;
+        for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_SLOTS; slot++) {
+            entries[3].textureView = texture_streamer_view(output->textures,slot);
+            output->materials.bindGroups[slot] = bind_group_cache_get(cache,&bgDesc);
+        }
+    }
+    bind_group_cache_end_frame(cache);
+}
+
+// Pipeline for each combination of material features
+ScenePipelineKey material_pipeline_key(const PipelineSetupOutput* output, uint32_t slot) {
+    ScenePipelineKey key = output->materialKey;
+    key.features |= slot & MATERIAL_FEATURE_MASK;
+    return key;
+}
+
+void update_material_pipelines(PipelineSetupOutput* output) {
+    if (!output->materials.cpuDraws) {
+        return;
+    }
+    for (uint32_t slot = 0; slot < MATERIAL_PIPELINE_SLOTS; slot++) {
+        ScenePipelineKey key = material_pipeline_key(output,slot);
+        output->materials.pipelines[slot] = pipeline_cache_get(output->pipelineCache,&key);
+    }
+}
+
+// Load the --texture files, or generate a few textures if there are none
+void load_textures(TextureStreamer* textures, const RenderOptions* options) {
+    for (uint32_t i = 0; i < options->textureCount; i++) {
+        TextureSource source;
+        if (texture_load(options->texturePaths[i],&source)) {
+            texture_streamer_add(textures,&source);
+        }
+    }
+    if (!textures->textures.empty()) {
+        return;
+    }
+
+    // Together more than the default texture budget, so cycling through
+    // them has something to evict
+    const float colors[4][3] = {
+        {0.9f, 0.3f, 0.2f},
+        {0.2f, 0.7f, 0.3f},
+        {0.2f, 0.4f, 0.9f},
+        {0.9f, 0.8f, 0.2f}
+    };
+    for (const float* color : colors) {
+        TextureSource source;
+        texture_generate_checker(&source,1024,color);
+        texture_streamer_add(textures,&source);
+    }
+}
+
+// Returns false if the GPU memory budget is too small for the scene
+bool create_buffers(PipelineSetupOutput* output, WGPUInstance instance, WGPUDevice* device_ptr, WGPUTextureFormat* preferredFormat_ptr,
+                    const std::vector<InstanceData>& scene, const std::vector<MaterialData>& materials,
+                    const std::vector<uint32_t>& instanceMaterials, const RenderOptions* options) {
     // Create the buffers we'll be using and put them in a bind group
     WGPUDevice device = *device_ptr;
     WGPUTextureFormat preferred_format = *preferredFormat_ptr;
@@ -121,18 +550,8 @@ void create_buffers(PipelineSetupOutput* output, WGPUDevice* device_ptr, WGPUTex
     };
 
     // Vertex buffer to hold object we render
-    WGPUBufferDescriptor pointBufferDesc = {};
-    pointBufferDesc.label = {"Vertex buffer",WGPU_STRLEN};
-    pointBufferDesc.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex;
-    pointBufferDesc.nextInChain = nullptr;
-    pointBufferDesc.size = sizeof(points);
-    pointBufferDesc.mappedAtCreation = true;
-    WGPUBuffer pointBuffer = wgpuDeviceCreateBuffer(device,&pointBufferDesc);
-
-    // Map the buffer --- get the pointer to the buffer data and memcpy our data to it
-    void* pointBufferAddr = wgpuBufferGetMappedRange(pointBuffer,0,sizeof(points));
-    memcpy(pointBufferAddr,points,sizeof(points));
-    wgpuBufferUnmap(pointBuffer);
+    BufferHandle pointBuffer(create_buffer_with_data(device,"Vertex buffer",
+        WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex,points,sizeof(points)));
 
     // Index buffer --- identifies which points are different vertices
     // using fixed size int to ensure GPU gets the right size int from us
@@ -146,18 +565,8 @@ void create_buffers(PipelineSetupOutput* output, WGPUDevice* device_ptr, WGPUTex
         0, 4, 5, 0, 5, 1
     };
 
-    WGPUBufferDescriptor indexBufferDesc = {};
-    indexBufferDesc.label = {"Index buffer",WGPU_STRLEN};
-    indexBufferDesc.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Index;
-    indexBufferDesc.nextInChain = nullptr;
-    indexBufferDesc.size = sizeof(indices);
-    indexBufferDesc.mappedAtCreation = true;
-    WGPUBuffer indexBuffer = wgpuDeviceCreateBuffer(device,&indexBufferDesc);
-
-    // Map the buffer --- get the pointer to the buffer data and memcpy our data to it
-    void* indexBufferAddr = wgpuBufferGetMappedRange(indexBuffer,0,sizeof(indices));
-    memcpy(indexBufferAddr,indices,sizeof(indices));
-    wgpuBufferUnmap(indexBuffer);
+    BufferHandle indexBuffer(create_buffer_with_data(device,"Index buffer",
+        WGPUBufferUsage_CopyDst | WGPUBufferUsage_Index,indices,sizeof(indices)));
 
     // Uniform buffer for coordinate transformations
     // Initial transforms:
@@ -175,140 +584,18 @@ void create_buffers(PipelineSetupOutput* output, WGPUDevice* device_ptr, WGPUTex
         0., 0., 0., 1.
     }};
 
-    WGPUBufferDescriptor transformBufferDesc = {};
-    transformBufferDesc.label = {"Coordinate transform buffer",WGPU_STRLEN};
-    transformBufferDesc.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform;
-    transformBufferDesc.nextInChain = nullptr;
-    transformBufferDesc.size = 2 * sizeof(CoordTransform); // we need to hold transform of object and light
-    transformBufferDesc.mappedAtCreation = true;
-    WGPUBuffer transformBuffer = wgpuDeviceCreateBuffer(device,&transformBufferDesc);
-
-    void* tfBufferAddr = wgpuBufferGetMappedRange(transformBuffer,0,sizeof(CoordTransform));
-    void* tfBufferAddrHalf = wgpuBufferGetMappedRange(transformBuffer,sizeof(CoordTransform),sizeof(CoordTransform));
-    memcpy(tfBufferAddr,tf_object.coords,sizeof(CoordTransform));
-    memcpy(tfBufferAddrHalf,tf_light.coords,sizeof(CoordTransform));
-    wgpuBufferUnmap(transformBuffer);
-
-    // Create bind group to hold buffers
-    WGPUBindGroupLayoutDescriptor bglDesc = {};
-    bglDesc.label = {"Bind group layout",WGPU_STRLEN};
-    bglDesc.nextInChain = nullptr;
-    bglDesc.entryCount = 1;
-    WGPUBindGroupLayoutEntry layoutEntries[1] = {};
-
-    layoutEntries[0].binding = 0;
-    layoutEntries[0].visibility = WGPUShaderStage_Vertex | WGPUShaderStage_Fragment;
-    layoutEntries[0].buffer.type = WGPUBufferBindingType_Uniform;
-    layoutEntries[0].nextInChain = nullptr;
-
-    bglDesc.entries = layoutEntries;
-    WGPUBindGroupLayout layout = wgpuDeviceCreateBindGroupLayout(device,&bglDesc);
-
-    WGPUBindGroupDescriptor bgDesc = {};
-    bgDesc.entryCount = 1;
-    bgDesc.nextInChain = nullptr;
-    bgDesc.label = {"Bind group",WGPU_STRLEN};
-    bgDesc.layout = layout;
-
-    WGPUBindGroupEntry entries[1] = {};
-
-    entries[0].binding = 0;
-    entries[0].buffer = transformBuffer;
-    entries[0].offset = 0;
-    entries[0].size = WGPU_WHOLE_SIZE;
-    entries[0].nextInChain = nullptr;
-    
-    bgDesc.entries = entries;
-    WGPUBindGroup bindGroup = wgpuDeviceCreateBindGroup(device,&bgDesc);
-
-    // Create pipeline
-    WGPUPipelineLayoutDescriptor pipelineLayoutDescRender = {};
-    WGPUBindGroupLayout layoutsRender[] = {layout}; // only one bind group
-    pipelineLayoutDescRender.bindGroupLayouts = layoutsRender;
-    pipelineLayoutDescRender.bindGroupLayoutCount = 1;
-    WGPUPipelineLayout pipelineLayoutRender = wgpuDeviceCreatePipelineLayout(device,&pipelineLayoutDescRender);
-
-    WGPURenderPipelineDescriptor renderDesc = {};
-    renderDesc.label = {"particle-render-pipeline",WGPU_STRLEN};
+    // we need to hold transform of object and light, the feature flags and the cursor
+    TransformUniform transformUniform = {};
+    transformUniform.object = tf_object;
+    transformUniform.light = tf_light;
+    transformUniform.features = {{options->shaderFeatures, 0, 0, 0}};
+    transformUniform.pointer = {{0.4f, 0.8f, 0.0f, 0.0f}};
+    BufferHandle transformBuffer(create_buffer_with_data(device,"Coordinate transform buffer",
+        WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform,&transformUniform,sizeof(TransformUniform)));
 
-    // Load our shader for rendering
-
-    std::string shaderString = LoadWGSLShader("src/simple_shader.wgsl");
-    WGPUStringView shaderStringView = {};
-    shaderStringView.data = shaderString.c_str();
-    shaderStringView.length = shaderString.length();
-
-    WGPUShaderModuleWGSLDescriptor shaderCodeDesc = {};
-    shaderCodeDesc.code = shaderStringView;
-    shaderCodeDesc.chain.next = nullptr;
-    shaderCodeDesc.chain.sType = WGPUSType_ShaderSourceWGSL;
-
-    WGPUShaderModuleDescriptor shaderDesc = {};
-    shaderDesc.nextInChain = &shaderCodeDesc.chain;
-    WGPUShaderModule renderShader = wgpuDeviceCreateShaderModule(device, &shaderDesc);
-
-    renderDesc.vertex.module = renderShader;
-    renderDesc.vertex.entryPoint = {"vs_main",WGPU_STRLEN};
-
-    // How our vertex data is stored in the buffer
-    WGPUVertexBufferLayout vertexBufLayout = {};
-    vertexBufLayout.arrayStride = sizeof(float) * 3; // 3 floats per vertex
-    vertexBufLayout.nextInChain = nullptr;
-    vertexBufLayout.attributeCount = 1;
-    vertexBufLayout.stepMode = WGPUVertexStepMode_Vertex;
-
-    WGPUVertexAttribute vertexAttr;
-    vertexAttr.format = WGPUVertexFormat_Float32x3;
-    vertexAttr.offset = 0;
-    vertexAttr.nextInChain = nullptr;
-    vertexAttr.shaderLocation = 0; // corresponds to @location(0) in the shader
-    vertexBufLayout.attributes = &vertexAttr;
-
-    renderDesc.layout = pipelineLayoutRender;
-    renderDesc.vertex.bufferCount = 1;
-    renderDesc.vertex.buffers = &vertexBufLayout;
-    renderDesc.vertex.constantCount = 0;
-    renderDesc.vertex.constants = nullptr;
-
-    WGPUFragmentState fragment = {};
-    fragment.module = renderShader;
-    fragment.entryPoint = {"fs_main",WGPU_STRLEN};
-    fragment.constantCount = 0;
-    fragment.constants = nullptr;
-    renderDesc.fragment = &fragment;
-
-    WGPUBlendState blendState = {};
-    blendState.color.srcFactor = WGPUBlendFactor_SrcAlpha;
-    blendState.color.dstFactor = WGPUBlendFactor_OneMinusSrcAlpha;
-    blendState.color.operation = WGPUBlendOperation_Add;
-
-    blendState.alpha.srcFactor = WGPUBlendFactor_Zero;
-    blendState.alpha.dstFactor = WGPUBlendFactor_One;
-    blendState.alpha.operation = WGPUBlendOperation_Add;
-    
-    WGPUColorTargetState colorTarget = {};
-    colorTarget.format = preferred_format;
-    colorTarget.blend = &blendState;
-    colorTarget.writeMask = WGPUColorWriteMask_All;
-    fragment.targetCount = 1;
-    fragment.targets = &colorTarget;
-    renderDesc.primitive.topology = WGPUPrimitiveTopology_TriangleList;
-
-    // Depth stencil is necessary to figure out which fragments are drawn in 3D
-    // This configuration is taken from https://eliemichel.github.io/LearnWebGPU/basic-3d-rendering/3d-meshes/depth-buffer.html
-    WGPUDepthStencilState depthStencilState = {};
-    setDefault(depthStencilState);
-
-    // Blend fragment only if depth is less than current Z buffer
-    depthStencilState.depthCompare = WGPUCompareFunction_Less;
-    // Update depth in Z buffer once fragment is drawn
-    depthStencilState.depthWriteEnabled = WGPUOptionalBool_True;
-    // Store the depth format in a variable
-    WGPUTextureFormat depthTextureFormat = WGPUTextureFormat_Depth24Plus;
-    depthStencilState.format = depthTextureFormat;
-    depthStencilState.stencilReadMask = 0;
-    depthStencilState.stencilWriteMask = 0;
-    renderDesc.depthStencil = &depthStencilState;
+    // Store the depth format in a variable. Reverse-Z only pays off with a
+    // float format, a 24 bit normalized one has the same precision everywhere.
+    WGPUTextureFormat depthTextureFormat = options->reverseZ ? WGPUTextureFormat_Depth32Float : WGPUTextureFormat_Depth24Plus;
 
     WGPUTextureDescriptor depthTextureDesc = {};
     depthTextureDesc.dimension = WGPUTextureDimension_2D;
@@ -320,10 +607,15 @@ void create_buffers(PipelineSetupOutput* output, WGPUDevice* device_ptr, WGPUTex
     uint32_t height = output->height;
     uint32_t width = output->width;
     depthTextureDesc.size = {width, height, 1};
-    depthTextureDesc.usage = WGPUTextureUsage_RenderAttachment;
+    // Also bound as a texture so the culling pass can build its Hi-Z pyramid from it
+    depthTextureDesc.usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_TextureBinding;
     depthTextureDesc.viewFormatCount = 1;
     depthTextureDesc.viewFormats = &depthTextureFormat;
-    WGPUTexture depthTexture = wgpuDeviceCreateTexture(device, &depthTextureDesc);
+    TextureHandle depthTexture(tracked_create_texture(device, &depthTextureDesc));
+    if (!pointBuffer || !indexBuffer || !transformBuffer || !depthTexture) {
+        pop_error_scope(device);
+        return false;
+    }
 
     WGPUTextureViewDescriptor depthTextureViewDesc = {};
     depthTextureViewDesc.nextInChain = nullptr;
@@ -334,34 +626,259 @@ void create_buffers(PipelineSetupOutput* output, WGPUDevice* device_ptr, WGPUTex
     depthTextureViewDesc.mipLevelCount = 1;
     depthTextureViewDesc.dimension = WGPUTextureViewDimension_2D;
     depthTextureViewDesc.format = depthTextureFormat;
-    WGPUTextureView depthTextureView = wgpuTextureCreateView(depthTexture, &depthTextureViewDesc);
+    TextureViewHandle depthTextureView(wgpuTextureCreateView(depthTexture, &depthTextureViewDesc));
+
+    // Override constants shared by every shader that includes transform.wgsl
+    TransformConstants transform = {};
+    transform.tilt = SCENE_TILT;
+    transform.aspect = (float)width / (float)height;
+    transform.reverseZ = options->reverseZ;
+
+    // Occlusion culling owns the instance data and decides what gets drawn.
+    // The subsystems hold their GPU objects in handles, so returning early
+    // releases whatever part of them was made.
+    HiZCulling culling = {};
+    FrameStats frameStats = {};
+    // The sweep needs room for its largest light count
+    uint32_t lightCapacity = 0;
+    if (options->lightSweep) {
+        lightCapacity = lightSweepCounts[LIGHT_SWEEP_STEPS / 2 - 1];
+    } else if (options->shaderFeatures & SHADER_FEATURE_LIGHTS) {
+        lightCapacity = options->lightCount;
+    }
+    std::vector<LightData> lights = build_lights(lightCapacity);
+
+    ClusteredLighting lighting = {};
+
+    // The window draws through a single identity camera. Batch mode renders
+    // offscreen, so it doesn't have to match the surface format.
+    bool batch = options->batchViews > 0;
+    std::vector<ViewData> views(1);
+    for (int i = 0; i < 16; i++) {
+        views[0].camera[i] = i % 5 == 0 ? 1.0f : 0.0f;
+    }
+    if (batch) {
+        views = build_views(options->batchViews);
+    }
+    WGPUTextureFormat batchFormat = WGPUTextureFormat_RGBA8Unorm;
+    MultiView multiView = {};
+
+    // The material scene is drawn from a sorted list on the CPU instead of
+    // the culling pass, front to back by the depth of each instance's center
+    bool materialDraws = strcmp(options->scene,"materials") == 0 && !batch;
+    std::vector<float> instanceDepths;
+    for (const InstanceData& inst : scene) {
+        float viewZ = cosf(SCENE_TILT) * inst.center[2] - sinf(SCENE_TILT) * inst.center[1];
+        instanceDepths.push_back(viewZ * 0.5f + 0.5f);
+    }
+    MaterialSystem materialSystem = {};
+
+    if (!hiz_culling_create(&culling,device,depthTextureView,width,height,36,scene.data(),(uint32_t)scene.size(),&transform) ||
+        !clustered_lighting_create(&lighting,device,lights.data(),lightCapacity,width,height,&transform) ||
+        !multi_view_create(&multiView,device,views.data(),(uint32_t)views.size(),batch,width,height,batchFormat,
+                           depthTextureFormat,culling.instanceBuffer,(uint32_t)scene.size(),36,&transform) ||
+        !material_system_create(&materialSystem,device,materials.data(),(uint32_t)materials.size(),instanceMaterials.data(),
+                                instanceDepths.data(),(uint32_t)scene.size(),materialDraws,!options->unsortedDraws) ||
+        !frame_stats_create(&frameStats,device)) {
+        pop_error_scope(device);
+        return false;
+    }
 
-    renderDesc.primitive.stripIndexFormat = WGPUIndexFormat_Undefined;
-    renderDesc.primitive.frontFace = WGPUFrontFace_CCW;
-    renderDesc.primitive.cullMode = WGPUCullMode_None;
-    renderDesc.multisample.count = 1;
-    renderDesc.multisample.mask = ~0u;
-    renderDesc.multisample.alphaToCoverageEnabled = false;
+    // Mip levels stream in while the scene renders, the texture feature
+    // shows the placeholder until they do
+    TextureStreamer* textures = new TextureStreamer();
+    if (!texture_streamer_create(textures,instance,device,(uint64_t)options->textureBudgetMB << 20)) {
+        texture_streamer_release(textures);
+        delete textures;
+        pop_error_scope(device);
+        return false;
+    }
+    if ((options->shaderFeatures & SHADER_FEATURE_TEXTURE) || materialDraws) {
+        load_textures(textures,options);
+    }
 
-    WGPURenderPipeline renderPipeline = wgpuDeviceCreateRenderPipeline(device,&renderDesc); 
+    // Create bind group to hold buffers
+    WGPUBindGroupLayoutDescriptor bglDesc = {};
+    bglDesc.label = {"Bind group layout",WGPU_STRLEN};
+    bglDesc.nextInChain = nullptr;
+    bglDesc.entryCount = 7;
+    WGPUBindGroupLayoutEntry layoutEntries[7] = {};
+
+    layoutEntries[0].binding = 0;
+    layoutEntries[0].visibility = WGPUShaderStage_Vertex | WGPUShaderStage_Fragment;
+    layoutEntries[0].buffer.type = WGPUBufferBindingType_Uniform;
+    layoutEntries[0].nextInChain = nullptr;
+
+    // Instances and the list of visible instance ids from the culling pass
+    for (int i = 1; i < 3; i++) {
+        setDefault(layoutEntries[i]);
+        layoutEntries[i].binding = i;
+        layoutEntries[i].visibility = WGPUShaderStage_Vertex;
+        layoutEntries[i].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+        layoutEntries[i].nextInChain = nullptr;
+    }
+
+    // The streamed texture and its sampler
+    setDefault(layoutEntries[3]);
+    layoutEntries[3].binding = 3;
+    layoutEntries[3].visibility = WGPUShaderStage_Fragment;
+    layoutEntries[3].texture.sampleType = WGPUTextureSampleType_Float;
+    layoutEntries[3].texture.viewDimension = WGPUTextureViewDimension_2D;
+
+    setDefault(layoutEntries[4]);
+    layoutEntries[4].binding = 4;
+    layoutEntries[4].visibility = WGPUShaderStage_Fragment;
+    layoutEntries[4].sampler.type = WGPUSamplerBindingType_Filtering;
+
+    // Materials and the material id of every instance
+    for (int i = 5; i < 7; i++) {
+        setDefault(layoutEntries[i]);
+        layoutEntries[i].binding = i;
+        layoutEntries[i].visibility = WGPUShaderStage_Vertex;
+        layoutEntries[i].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+    }
+
+    bglDesc.entries = layoutEntries;
+    BindGroupLayoutHandle layout(wgpuDeviceCreateBindGroupLayout(device,&bglDesc));
+
+    // Create pipeline
+    WGPUPipelineLayoutDescriptor pipelineLayoutDescRender = {};
+    // Scene data in group 0, the lights in group 1, the camera in group 2
+    WGPUBindGroupLayout layoutsRender[] = {layout, lighting.renderLayout, multiView.layout};
+    pipelineLayoutDescRender.bindGroupLayouts = layoutsRender;
+    pipelineLayoutDescRender.bindGroupLayoutCount = 3;
+    PipelineLayoutHandle pipelineLayoutRender(wgpuDeviceCreatePipelineLayout(device,&pipelineLayoutDescRender));
+
+    // Load our shader for rendering
+    std::string shaderString;
+    for (const std::string& path : renderShaderPaths) {
+        shaderString += LoadWGSLShader(path);
+    }
+    ShaderModuleHandle renderShader(create_shader_module(device, shaderString, "Render shader"));
+
+    // Every scene pipeline is a variant of the same shader, looked up by what
+    // it gets specialized with. The cache keeps its own references.
+    PipelineCache* pipelineCache = new PipelineCache();
+    pipeline_cache_init(pipelineCache,device,pipelineLayoutRender,renderShader);
+
+    ScenePipelineKey colorKey;
+    scene_pipeline_key_init(&colorKey);
+    colorKey.features = options->shaderFeatures;
+    colorKey.uniformBranching = options->uniformBranching;
+    // The clusters are binned for the window's camera, batch views loop
+    // over every light instead
+    colorKey.clusteredLights = !options->naiveLights && !batch;
+    lighting.binLights = colorKey.clusteredLights;
+    colorKey.colorFormat = preferred_format;
+    colorKey.depthFormat = depthTextureFormat;
+    colorKey.transform = transform;
+
+    // Without a pre-pass the color pass does the depth test and write itself.
+    // With one, the pre-pass does that and the color pass only shades the
+    // fragments whose depth is exactly what ended up in the buffer.
+    WGPUCompareFunction nearerCompare = options->reverseZ ? WGPUCompareFunction_Greater : WGPUCompareFunction_Less;
+    WGPURenderPipeline depthPrepassPipeline = nullptr;
+    ScenePipelineKey depthKey = colorKey;
+    if (options->depthPrepass) {
+        depthKey.depthOnly = true;
+        depthKey.depthWrite = true;
+        depthKey.depthCompare = nearerCompare;
+        depthPrepassPipeline = pipeline_cache_get(pipelineCache,&depthKey);
+
+        colorKey.depthWrite = false;
+        colorKey.depthCompare = WGPUCompareFunction_Equal;
+    } else {
+        colorKey.depthWrite = true;
+        colorKey.depthCompare = nearerCompare;
+    }
+    WGPURenderPipeline renderPipeline = pipeline_cache_get(pipelineCache,&colorKey);
+
+    // Batch views draw without a pre-pass into the texture array format
+    WGPURenderPipeline batchPipeline = nullptr;
+    ScenePipelineKey batchKey = colorKey;
+    if (batch) {
+        batchKey.colorFormat = batchFormat;
+        batchKey.depthWrite = true;
+        batchKey.depthCompare = nearerCompare;
+        batchPipeline = pipeline_cache_get(pipelineCache,&batchKey);
+    }
+
+    // Materials pick their own features on top of --features, always
+    // specialized, and they are drawn without a pre-pass
+    ScenePipelineKey materialKey = colorKey;
+    materialKey.uniformBranching = 0;
+    materialKey.depthWrite = true;
+    materialKey.depthCompare = nearerCompare;
 
     // Write created pipeline components to struct passed as input
     *output = {
-        .pointBuffer=pointBuffer,
-        .indexBuffer=indexBuffer,
-        .transformBuffer=transformBuffer,
-        .bindGroup=bindGroup,
+        .pointBuffer=std::move(pointBuffer),
+        .indexBuffer=std::move(indexBuffer),
+        .transformBuffer=std::move(transformBuffer),
+        .bindGroupLayout=std::move(layout),
+        .bindGroupCache=new BindGroupCache(),
         .renderPipeline=renderPipeline,
-        .depthTexture=depthTexture,
-        .depthTextureView=depthTextureView
+        .depthPrepassPipeline=depthPrepassPipeline,
+        .batchPipeline=batchPipeline,
+        .pipelineCache=pipelineCache,
+        .colorKey=colorKey,
+        .depthKey=depthKey,
+        .batchKey=batchKey,
+        .materialKey=materialKey,
+        .depthTexture=std::move(depthTexture),
+        .depthTextureView=std::move(depthTextureView),
+        .culling=std::move(culling),
+        .lighting=std::move(lighting),
+        .views=std::move(multiView),
+        .materials=std::move(materialSystem),
+        .frameStats=std::move(frameStats),
+        .textures=textures,
+        .activeTexture=0,
+        .options=*options,
+        .height=height,
+        .width=width
     };
+    bind_group_cache_init(output->bindGroupCache,device);
+    resolve_scene_bind_groups(output);
+    update_material_pipelines(output);
+    pipeline_cache_report(pipelineCache);
 
     // Pop error scope to see any errors
-    WGPUPopErrorScopeCallbackInfo cbInfo = {};
-    cbInfo.callback = &error_callback;
-    cbInfo.nextInChain = nullptr;
-    cbInfo.mode = WGPUCallbackMode_AllowSpontaneous;
-    wgpuDevicePopErrorScope(device,cbInfo);
+    pop_error_scope(device);
+    return true;
+}
+
+// Everything create_buffers() made
+void release_buffers(PipelineSetupOutput* output) {
+    hiz_culling_release(&output->culling);
+    clustered_lighting_release(&output->lighting);
+    multi_view_release(&output->views);
+    material_system_release(&output->materials);
+    frame_stats_release(&output->frameStats);
+    pipeline_cache_report(output->pipelineCache);
+    pipeline_cache_release(output->pipelineCache);
+    delete output->pipelineCache;
+    output->pipelineCache = nullptr;
+    output->renderPipeline = nullptr;
+    output->depthPrepassPipeline = nullptr;
+    output->batchPipeline = nullptr;
+
+    bind_group_cache_report(output->bindGroupCache);
+    bind_group_cache_release(output->bindGroupCache);
+    delete output->bindGroupCache;
+    output->bindGroupCache = nullptr;
+    output->earlyBindGroup = nullptr;
+    output->lateBindGroup = nullptr;
+    output->batchBindGroup = nullptr;
+    texture_streamer_release(output->textures);
+    delete output->textures;
+    output->textures = nullptr;
+    output->bindGroupLayout.reset();
+    output->pointBuffer.reset();
+    output->indexBuffer.reset();
+    output->transformBuffer.reset();
+    output->depthTextureView.reset();
+    output->depthTexture.reset();
 }
 
 // Get the next surface texture and target view
@@ -391,15 +908,7 @@ SurfaceViewData get_next_surface_view_data(WGPUSurface* surface) {
     return {surfaceTexture, targetView};
 }
 
-// These callbacks are used for the async functions getting adapter and device
-void adapter_callback(WGPURequestAdapterStatus status, WGPUAdapter adapter, WGPUStringView message, void* userdata1, void* userdata2) {
-    if (status != WGPURequestAdapterStatus_Success) {
-            fprintf(stderr,"Failed to get an adapter: %s",message.data);
-            return;
-        }
-        *(WGPUAdapter*)(userdata1) = adapter;
-}
-
+// Callback for the async device request (adapters are requested in adapter_selection.cpp)
 void device_callback(WGPURequestDeviceStatus status, WGPUDevice device, WGPUStringView message, void* userdata1, void* userdata2) {
     if (status != WGPURequestDeviceStatus_Success) {
             fprintf(stderr,"Failed to get a device: %s",message.data);
@@ -408,47 +917,32 @@ void device_callback(WGPURequestDeviceStatus status, WGPUDevice device, WGPUStri
         *(WGPUDevice*)(userdata1) = device;
 }
 
-void main_loop(WGPUSurface* surface_ptr, WGPUDevice* device_ptr, WGPUQueue* queue_ptr, PipelineSetupOutput* pipeline_setup_ptr) {
-    // Main rendering loop to run
-    WGPUSurface surface = *surface_ptr;
-    WGPUDevice device = *device_ptr;
-    WGPUQueue queue = *queue_ptr;
-    PipelineSetupOutput setup_params = *pipeline_setup_ptr;
-
-    // Push the error scope to catch Validation errors
-    wgpuDevicePushErrorScope(device,WGPUErrorFilter_Validation);
-
-    // Command encoder writes instructions
-    WGPUCommandEncoderDescriptor encoderDesc = {};
-    encoderDesc.nextInChain = nullptr;
-    encoderDesc.label = WGPUStringView{"Command encoder", WGPU_STRLEN};
-    WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(device, &encoderDesc);
-
-    SurfaceViewData surfViewData = get_next_surface_view_data(&surface);
-    WGPUSurfaceTexture surface_texture = surfViewData.surfaceTexture;
-
-    printf("Surface texture status: %d\n", surface_texture.status);
-
-    WGPUTextureView targetView = surfViewData.textureView;
-    if (!targetView) {
-        printf("Target view is NULL! Skipping iteration\n");
-        wgpuCommandEncoderRelease(encoder);
-        return;
-    }
-
-    // Texture can be released after getting texture view if backend isn't WGPU
-#ifndef WEBGPU_BACKEND_WGPU
-    //wgpuTextureRelease(surface_texture.texture);
-#endif
-
-    // Build render pass encoder
+// Which visible lists a scene pass draws
+#define DRAW_EARLY_LIST 1
+#define DRAW_LATE_LIST 2
+#define DRAW_BATCH_LIST 4
+#define DRAW_MATERIAL_LIST 8
+
+// One render pass over the culled instances
+typedef struct ScenePass {
+    WGPURenderPipeline pipeline; // nullptr when the material list picks them
+    WGPUTextureView targetView; // nullptr for a depth-only pass
+    WGPUTextureView depthView;  // nullptr for the window's depth buffer
+    uint32_t view;              // camera in the view buffer
+    WGPULoadOp loadOp;          // clear on the first pass, keep afterwards
+    bool depthReadOnly;         // color pass after a depth pre-pass
+    uint32_t lists;             // DRAW_EARLY_LIST | DRAW_LATE_LIST, DRAW_BATCH_LIST or DRAW_MATERIAL_LIST
+    bool countShaded;           // wrap the draws in an occlusion query
+} ScenePass;
+
+void encode_scene_pass(WGPUCommandEncoder encoder, PipelineSetupOutput* setup_params, const ScenePass* pass) {
     WGPURenderPassDescriptor renderPassDesc = {};
     renderPassDesc.nextInChain = nullptr;
 
     WGPURenderPassColorAttachment renderPassColorAttachment = {};
-    renderPassColorAttachment.view = targetView; // render directly on screen
+    renderPassColorAttachment.view = pass->targetView; // render directly on screen
     renderPassColorAttachment.resolveTarget = nullptr;
-    renderPassColorAttachment.loadOp = WGPULoadOp_Clear; // load default color clear
+    renderPassColorAttachment.loadOp = pass->loadOp;
     renderPassColorAttachment.storeOp = WGPUStoreOp_Store;
     renderPassColorAttachment.clearValue = WGPUColor{0.0, 0.6, 0.9, 1.0};
     
@@ -457,21 +951,27 @@ void main_loop(WGPUSurface* surface_ptr, WGPUDevice* device_ptr, WGPUQueue* queu
     renderPassColorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
 #endif
 
-    renderPassDesc.colorAttachmentCount = 1;
+    renderPassDesc.colorAttachmentCount = pass->targetView ? 1 : 0;
     renderPassDesc.colorAttachments = &renderPassColorAttachment;
 
     WGPURenderPassDepthStencilAttachment depthStencilAttachment = {};
 
     // The view of the depth texture
-    depthStencilAttachment.view = setup_params.depthTextureView;
+    depthStencilAttachment.view = pass->depthView ? pass->depthView : (WGPUTextureView)setup_params->depthTextureView;
 
     // The initial value of the depth buffer, meaning "far"
-    depthStencilAttachment.depthClearValue = 1.0f;
+    depthStencilAttachment.depthClearValue = setup_params->options.reverseZ ? 0.0f : 1.0f;
     // Operation settings comparable to the color attachment
-    depthStencilAttachment.depthLoadOp = WGPULoadOp_Clear;
-    depthStencilAttachment.depthStoreOp = WGPUStoreOp_Store;
     // we could turn off writing to the depth buffer globally here
-    depthStencilAttachment.depthReadOnly = false;
+    depthStencilAttachment.depthReadOnly = pass->depthReadOnly;
+    if (pass->depthReadOnly) {
+        // Read-only depth must not have load/store ops
+        depthStencilAttachment.depthLoadOp = WGPULoadOp_Undefined;
+        depthStencilAttachment.depthStoreOp = WGPUStoreOp_Undefined;
+    } else {
+        depthStencilAttachment.depthLoadOp = pass->loadOp;
+        depthStencilAttachment.depthStoreOp = WGPUStoreOp_Store;
+    }
 
     // Stencil setup, mandatory but unused
     depthStencilAttachment.stencilClearValue = 0;
@@ -484,29 +984,202 @@ void main_loop(WGPUSurface* surface_ptr, WGPUDevice* device_ptr, WGPUQueue* queu
     //renderPassDesc.depthStencilAttachment = nullptr;
     renderPassDesc.timestampWrites = nullptr;
 
-    WGPURenderPassEncoder renderPass = wgpuCommandEncoderBeginRenderPass(encoder, &renderPassDesc);
+    uint32_t query = WGPU_QUERY_SET_INDEX_UNDEFINED;
+    if (pass->countShaded) {
+        query = frame_stats_next_query(&setup_params->frameStats);
+        renderPassDesc.occlusionQuerySet = setup_params->frameStats.occlusionQuerySet;
+    }
 
-    wgpuRenderPassEncoderSetPipeline(renderPass,setup_params.renderPipeline);
-    wgpuRenderPassEncoderSetBindGroup(renderPass,0,setup_params.bindGroup,0,nullptr);
-    wgpuRenderPassEncoderSetVertexBuffer(renderPass,0,setup_params.pointBuffer,0,24*sizeof(float));
-    wgpuRenderPassEncoderSetIndexBuffer(renderPass,setup_params.indexBuffer,WGPUIndexFormat_Uint32,0,36*sizeof(uint32_t));
+    WGPURenderPassEncoder renderPass = wgpuCommandEncoderBeginRenderPass(encoder, &renderPassDesc);
+    if (query != WGPU_QUERY_SET_INDEX_UNDEFINED) {
+        wgpuRenderPassEncoderBeginOcclusionQuery(renderPass,query);
+    }
 
-    wgpuRenderPassEncoderDrawIndexed(renderPass,36,1,0,0,0);
+    if (pass->pipeline) {
+        wgpuRenderPassEncoderSetPipeline(renderPass,pass->pipeline);
+    }
+    wgpuRenderPassEncoderSetVertexBuffer(renderPass,0,setup_params->pointBuffer,0,24*sizeof(float));
+    wgpuRenderPassEncoderSetIndexBuffer(renderPass,setup_params->indexBuffer,WGPUIndexFormat_Uint32,0,36*sizeof(uint32_t));
+    wgpuRenderPassEncoderSetBindGroup(renderPass,1,setup_params->lighting.renderBindGroup,0,nullptr);
+    uint32_t viewOffset = multi_view_offset(pass->view);
+    wgpuRenderPassEncoderSetBindGroup(renderPass,2,setup_params->views.bindGroup,1,&viewOffset);
+
+    // Instance counts come from the culling pass
+    if (pass->lists & DRAW_EARLY_LIST) {
+        wgpuRenderPassEncoderSetBindGroup(renderPass,0,setup_params->earlyBindGroup,0,nullptr);
+        wgpuRenderPassEncoderDrawIndexedIndirect(renderPass,setup_params->culling.drawArgsBuffer,0);
+    }
+    if (pass->lists & DRAW_LATE_LIST) {
+        wgpuRenderPassEncoderSetBindGroup(renderPass,0,setup_params->lateBindGroup,0,nullptr);
+        wgpuRenderPassEncoderDrawIndexedIndirect(renderPass,setup_params->culling.drawArgsBuffer,DRAW_INDEXED_ARGS_SIZE);
+    }
+    if (pass->lists & DRAW_BATCH_LIST) {
+        wgpuRenderPassEncoderSetBindGroup(renderPass,0,setup_params->batchBindGroup,0,nullptr);
+        wgpuRenderPassEncoderDrawIndexedIndirect(renderPass,setup_params->views.drawArgsBuffer,0);
+    }
+    // Sorted on the CPU instead, with a pipeline and bind group per run
+    if (pass->lists & DRAW_MATERIAL_LIST) {
+        material_system_encode(&setup_params->materials,renderPass);
+    }
 
+    if (query != WGPU_QUERY_SET_INDEX_UNDEFINED) {
+        wgpuRenderPassEncoderEndOcclusionQuery(renderPass);
+    }
     wgpuRenderPassEncoderEnd(renderPass);
     wgpuRenderPassEncoderRelease(renderPass);
+}
+
+// Swap in the pipelines of a finished shader reload, if there is one. Frames
+// already submitted keep their own references to the old pipelines.
+void apply_shader_reload(PipelineSetupOutput* setup_params, ShaderReload* reload) {
+    std::vector<ScenePipelineKey> keys = {setup_params->colorKey};
+    if (setup_params->options.depthPrepass) {
+        keys.push_back(setup_params->depthKey);
+    }
+    if (setup_params->batchPipeline) {
+        keys.push_back(setup_params->batchKey);
+    }
+    if (setup_params->materials.cpuDraws) {
+        for (uint32_t slot = 0; slot < MATERIAL_PIPELINE_SLOTS; slot++) {
+            keys.push_back(material_pipeline_key(setup_params,slot));
+        }
+    }
+
+    PipelineCache* reloaded = shader_reload_poll(reload,setup_params->pipelineCache,keys);
+    if (!reloaded) {
+        return;
+    }
+    pipeline_cache_release(setup_params->pipelineCache);
+    delete setup_params->pipelineCache;
+    setup_params->pipelineCache = reloaded;
+
+    setup_params->renderPipeline = pipeline_cache_get(reloaded,&setup_params->colorKey);
+    if (setup_params->options.depthPrepass) {
+        setup_params->depthPrepassPipeline = pipeline_cache_get(reloaded,&setup_params->depthKey);
+    }
+    if (setup_params->batchPipeline) {
+        setup_params->batchPipeline = pipeline_cache_get(reloaded,&setup_params->batchKey);
+    }
+    update_material_pipelines(setup_params);
+}
+
+// Stream in the textures in use and look up the bind groups for this
+// frame. Unchanged views come back from the cache.
+void update_textures(PipelineSetupOutput* setup_params) {
+    TextureStreamer* textures = setup_params->textures;
+    if (setup_params->materials.cpuDraws) {
+        for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_SLOTS; slot++) {
+            texture_streamer_touch(textures,slot);
+        }
+        texture_streamer_update(textures);
+    } else if (setup_params->options.shaderFeatures & SHADER_FEATURE_TEXTURE) {
+        texture_streamer_touch(textures,setup_params->activeTexture);
+        texture_streamer_update(textures);
+    }
+    resolve_scene_bind_groups(setup_params);
+}
+
+void main_loop(WGPUSurface* surface_ptr, WGPUDevice* device_ptr, WGPUQueue* queue_ptr, PipelineSetupOutput* pipeline_setup_ptr) {
+    // Main rendering loop to run
+    WGPUSurface surface = *surface_ptr;
+    WGPUDevice device = *device_ptr;
+    WGPUQueue queue = *queue_ptr;
+    const PipelineSetupOutput& setup_params = *pipeline_setup_ptr;
+
+    // Push the error scope to catch Validation errors
+    wgpuDevicePushErrorScope(device,WGPUErrorFilter_Validation);
+
+    // Command encoder writes instructions
+    WGPUCommandEncoderDescriptor encoderDesc = {};
+    encoderDesc.nextInChain = nullptr;
+    encoderDesc.label = WGPUStringView{"Command encoder", WGPU_STRLEN};
+    WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(device, &encoderDesc);
+
+    SurfaceViewData surfViewData = get_next_surface_view_data(&surface);
+    WGPUSurfaceTexture surface_texture = surfViewData.surfaceTexture;
+
+    WGPUTextureView targetView = surfViewData.textureView;
+    if (!targetView) {
+        printf("Target view is NULL! Skipping iteration\n");
+        wgpuCommandEncoderRelease(encoder);
+        return;
+    }
+
+    // Texture can be released after getting texture view if backend isn't WGPU
+#ifndef WEBGPU_BACKEND_WGPU
+    //wgpuTextureRelease(surface_texture.texture);
+#endif
+
+    // Build render pass encoder
+    HiZCulling* culling = &pipeline_setup_ptr->culling;
+    hiz_culling_begin_frame(culling,queue);
+
+    FrameStats* frameStats = &pipeline_setup_ptr->frameStats;
+    frame_stats_begin_frame(frameStats);
+
+    ClusteredLighting* lighting = &pipeline_setup_ptr->lighting;
+    clustered_lighting_begin_frame(lighting,queue);
+
+    // Draw what was visible last frame, build the Hi-Z pyramid from that and
+    // then draw whatever the pyramid says became visible. With a depth
+    // pre-pass those two passes only write depth and a final pass shades both
+    // lists against it.
+    bool prepass = setup_params.options.depthPrepass;
+    ScenePass early = {};
+    early.pipeline = prepass ? setup_params.depthPrepassPipeline : setup_params.renderPipeline;
+    early.targetView = prepass ? nullptr : targetView;
+    early.loadOp = WGPULoadOp_Clear;
+    early.lists = DRAW_EARLY_LIST;
+    early.countShaded = !prepass;
+
+    ScenePass late = early;
+    late.loadOp = WGPULoadOp_Load;
+    late.lists = DRAW_LATE_LIST;
+
+    clustered_lighting_encode(lighting,encoder);
+
+    // The material scene draws everything from its sorted list in one pass
+    MaterialSystem* materials = &pipeline_setup_ptr->materials;
+    if (materials->cpuDraws) {
+        material_system_build_draws(materials,queue);
+        ScenePass pass = {};
+        pass.targetView = targetView;
+        pass.loadOp = WGPULoadOp_Clear;
+        pass.lists = DRAW_MATERIAL_LIST;
+        pass.countShaded = true;
+        encode_scene_pass(encoder,pipeline_setup_ptr,&pass);
+    } else {
+        hiz_culling_encode_early(culling,encoder);
+        encode_scene_pass(encoder,pipeline_setup_ptr,&early);
+        hiz_culling_encode_late(culling,encoder);
+        encode_scene_pass(encoder,pipeline_setup_ptr,&late);
+    }
+
+    if (prepass && !materials->cpuDraws) {
+        ScenePass shade = {};
+        shade.pipeline = setup_params.renderPipeline;
+        shade.targetView = targetView;
+        shade.loadOp = WGPULoadOp_Clear;
+        shade.depthReadOnly = true;
+        shade.lists = DRAW_EARLY_LIST | DRAW_LATE_LIST;
+        shade.countShaded = true;
+        encode_scene_pass(encoder,pipeline_setup_ptr,&shade);
+    }
+
+    if (!materials->cpuDraws) {
+        hiz_culling_encode_readback(culling,encoder);
+    }
+    frame_stats_encode_readback(frameStats,encoder);
 
     WGPUCommandBufferDescriptor cmdBufferDescriptor = {};
     cmdBufferDescriptor.nextInChain = nullptr;
     cmdBufferDescriptor.label = {"Command buffer",WGPU_STRLEN};
     WGPUCommandBuffer command = wgpuCommandEncoderFinish(encoder,&cmdBufferDescriptor);
 
-    printf("SurfaceTexture: %p\n",surface_texture);
-    printf("Texture: %p\n",surface_texture.texture);
-    printf("Target View: %p\n",targetView);
-
     wgpuQueueSubmit(queue,1,&command);
     wgpuCommandBufferRelease(command);
+    hiz_culling_request_readback(culling);
+    frame_stats_request_readback(frameStats);
     wgpuSurfacePresent(surface);
     
     wgpuTextureViewRelease(targetView);
@@ -518,14 +1191,204 @@ void main_loop(WGPUSurface* surface_ptr, WGPUDevice* device_ptr, WGPUQueue* queu
 #endif  
 
     // Pop the error scope to print errors that were caught
-    WGPUPopErrorScopeCallbackInfo cbInfo = {};
-    cbInfo.callback = &error_callback;
-    cbInfo.nextInChain = nullptr;
-    cbInfo.mode = WGPUCallbackMode_AllowSpontaneous;
-    wgpuDevicePopErrorScope(device,cbInfo);
+    pop_error_scope(device);
+}
+
+// Batch mode frame: every view rendered into its own texture array layer.
+// The light animation, the culling and the uploads happen once and all the
+// views go into the same command buffer.
+void render_batch(WGPUDevice device, WGPUQueue queue, PipelineSetupOutput* setup_params) {
+    wgpuDevicePushErrorScope(device,WGPUErrorFilter_Validation);
+
+    WGPUCommandEncoderDescriptor encoderDesc = {};
+    encoderDesc.nextInChain = nullptr;
+    encoderDesc.label = WGPUStringView{"Batch command encoder", WGPU_STRLEN};
+    WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(device, &encoderDesc);
+
+    MultiView* views = &setup_params->views;
+    multi_view_begin_frame(views,queue);
+    clustered_lighting_begin_frame(&setup_params->lighting,queue);
+
+    clustered_lighting_encode(&setup_params->lighting,encoder);
+    multi_view_encode_cull(views,encoder);
+    for (uint32_t i = 0; i < views->viewCount; i++) {
+        ScenePass pass = {};
+        pass.pipeline = setup_params->batchPipeline;
+        pass.targetView = views->colorViews[i];
+        pass.depthView = views->depthViews[i];
+        pass.view = i;
+        pass.loadOp = WGPULoadOp_Clear;
+        pass.lists = DRAW_BATCH_LIST;
+        encode_scene_pass(encoder,setup_params,&pass);
+    }
+
+    WGPUCommandBufferDescriptor cmdBufferDescriptor = {};
+    cmdBufferDescriptor.nextInChain = nullptr;
+    cmdBufferDescriptor.label = {"Batch command buffer",WGPU_STRLEN};
+    WGPUCommandBuffer command = wgpuCommandEncoderFinish(encoder,&cmdBufferDescriptor);
+    wgpuQueueSubmit(queue,1,&command);
+    wgpuCommandBufferRelease(command);
+    wgpuCommandEncoderRelease(encoder);
+
+    pop_error_scope(device);
+}
+
+// Switch the light count and shading loop to one step of --light-sweep
+void apply_light_sweep_step(PipelineSetupOutput* setup_params, uint32_t step) {
+    bool clustered = step % 2 == 0;
+    clustered_lighting_set_light_count(&setup_params->lighting,lightSweepCounts[step / 2]);
+    setup_params->lighting.binLights = clustered;
+    setup_params->colorKey.clusteredLights = clustered;
+    setup_params->renderPipeline = pipeline_cache_get(setup_params->pipelineCache,&setup_params->colorKey);
+    setup_params->materialKey.clusteredLights = clustered;
+    update_material_pipelines(setup_params);
+}
+
+// Everything the render thread works with. After setup it is the only
+// thread making WebGPU calls, so the async callbacks (culling and stats
+// readbacks, shader reloads, latency) all run there too.
+typedef struct RenderThreadContext {
+    WGPUInstance instance;
+    WGPUSurface surface;
+    WGPUDevice device;
+    WGPUQueue queue;
+    PipelineSetupOutput* setup;
+    ShaderReload* shaderReload;
+    InputQueue* inputQueue;
+    InputLatency latency;
+    std::atomic<bool> done; // set once the render thread has stopped
+    double totalFrameMs;    // benchmark mode, frames after warmup
+    std::chrono::steady_clock::time_point firstFrameDone; // benchmark mode, GPU finished frame 0
+} RenderThreadContext;
+
+void render_thread(RenderThreadContext* ctx) {
+    PipelineSetupOutput* setup_params = ctx->setup;
+    const RenderOptions* options = &setup_params->options;
+    uint32_t frame = 0;
+    uint32_t framesSinceReport = 0;
+    auto lastReport = std::chrono::steady_clock::now();
+
+    uint32_t sweepStep = 0;
+    double clusteredMs = 0.0;
+    if (options->lightSweep) {
+        apply_light_sweep_step(setup_params,sweepStep);
+        printf("Light sweep, %u frames per step:\n", options->benchmarkFrames);
+    }
+
+    bool quit = false;
+    while (!quit) {
+        auto frameStart = std::chrono::steady_clock::now();
+
+        // Only the newest input matters for this frame, but latency counts
+        // from the oldest event that hasn't made it on screen yet
+        InputSnapshot snapshot;
+        bool newInput = false;
+        uint32_t textureSteps = 0;
+        std::chrono::steady_clock::time_point firstEvent;
+        while (input_queue_pop(ctx->inputQueue,&snapshot)) {
+            if (!newInput) {
+                firstEvent = snapshot.eventTime;
+            }
+            newInput = true;
+            quit |= snapshot.command == INPUT_COMMAND_QUIT;
+            textureSteps += snapshot.command == INPUT_COMMAND_NEXT_TEXTURE;
+        }
+        if (quit) {
+            break;
+        }
+        if (newInput) {
+            PointerState pointer = {{snapshot.pointer[0], snapshot.pointer[1], 0.0f, 0.0f}};
+            wgpuQueueWriteBuffer(ctx->queue,setup_params->transformBuffer,POINTER_STATE_OFFSET,&pointer,sizeof(PointerState));
+        }
+        size_t textureCount = setup_params->textures->textures.size();
+        if (textureSteps > 0 && textureCount > 0) {
+            setup_params->activeTexture = (setup_params->activeTexture + textureSteps) % textureCount;
+        }
+        update_textures(setup_params);
+
+        if (options->batchViews > 0) {
+            render_batch(ctx->device,ctx->queue,setup_params);
+        } else {
+            main_loop(&ctx->surface,&ctx->device,&ctx->queue,setup_params);
+        }
+        if (newInput) {
+            input_latency_track(&ctx->latency,ctx->queue,firstEvent);
+        }
+
+        if (options->benchmarkFrames > 0) {
+            // Frame time includes the GPU work, not just encoding
+            wait_for_queue(ctx->instance,ctx->device,ctx->queue);
+            std::chrono::duration<double,std::milli> frameTime = std::chrono::steady_clock::now() - frameStart;
+            if (ctx->firstFrameDone == std::chrono::steady_clock::time_point()) {
+                ctx->firstFrameDone = std::chrono::steady_clock::now();
+            }
+            // Leave the first frames out, they pay for pipeline warmup and draw everything
+            if (frame >= 2) {
+                ctx->totalFrameMs += frameTime.count();
+            }
+            if (++frame >= options->benchmarkFrames + 2) {
+                if (!options->lightSweep) {
+                    break;
+                }
+                double msPerFrame = ctx->totalFrameMs / options->benchmarkFrames;
+                if (sweepStep % 2 == 0) {
+                    clusteredMs = msPerFrame;
+                } else {
+                    printf("%6u lights: clustered %.3f ms/frame, naive %.3f ms/frame (%.2fx)\n",
+                        lightSweepCounts[sweepStep / 2], clusteredMs, msPerFrame, msPerFrame / clusteredMs);
+                }
+                if (++sweepStep >= LIGHT_SWEEP_STEPS) {
+                    break;
+                }
+                apply_light_sweep_step(setup_params,sweepStep);
+                ctx->totalFrameMs = 0.0;
+                frame = 0;
+            }
+            continue;
+        }
+
+        // Ticked every frame no matter what the input thread is doing. The
+        // present blocks on vsync, which is what paces this loop.
+        wgpuInstanceProcessEvents(ctx->instance);
+#ifdef WEBGPU_BACKEND_DAWN
+        wgpuDeviceTick(ctx->device);
+#endif
+#ifdef WEBGPU_BACKEND_WGPU
+        wgpuDevicePoll(ctx->device, false, nullptr);
+#endif
+        if (ctx->shaderReload) {
+            apply_shader_reload(setup_params,ctx->shaderReload);
+        }
+
+        framesSinceReport++;
+        std::chrono::duration<double> sinceReport = std::chrono::steady_clock::now() - lastReport;
+        if (sinceReport.count() >= 1.0) {
+            if (options->batchViews > 0) {
+                printf("%.1f frames/s, %.1f views/s\n", framesSinceReport / sinceReport.count(),
+                    framesSinceReport * options->batchViews / sinceReport.count());
+            } else {
+                printf("%.1f frames/s, passed samples (backend-dependent): %llu\n", framesSinceReport / sinceReport.count(),
+                    (unsigned long long)setup_params->frameStats.shadedSamples);
+            }
+            input_latency_report(&ctx->latency);
+            resource_registry_print("GPU memory");
+            texture_streamer_report(setup_params->textures);
+            hiz_culling_report(&setup_params->culling);
+            material_system_report(&setup_params->materials);
+            framesSinceReport = 0;
+            lastReport = std::chrono::steady_clock::now();
+        }
+    }
+
+    // Let the outstanding callbacks run before main() releases what they use
+    wait_for_queue(ctx->instance,ctx->device,ctx->queue);
+    ctx->done = true;
+    glfwPostEmptyEvent();
 }
 
 int main(int argc, char** argv) {
+    auto startupStart = std::chrono::steady_clock::now();
+    RenderOptions options = parse_render_options(argc,argv);
 
     WGPUInstanceDescriptor instanceDesc{};
     instanceDesc.nextInChain = nullptr;
@@ -541,44 +1404,33 @@ int main(int argc, char** argv) {
     }
     printf("Created wgpu instance\n");
 
-    // Create adapter
-    WGPURequestAdapterOptions adapterOpts = {};
-    adapterOpts.nextInChain = nullptr;
-
-    WGPUAdapter adapter = nullptr;
-
-    auto callbackMode = WGPUCallbackMode_AllowProcessEvents;
-    WGPURequestAdapterCallbackInfo callbackInfo;
-    callbackInfo.callback = &adapter_callback;
-    callbackInfo.mode = callbackMode;
-    callbackInfo.userdata1 = &adapter;
-
-    // Start async adapter request
-    wgpuInstanceRequestAdapter(instance, &adapterOpts, callbackInfo);
+    std::chrono::duration<double,std::milli> instanceMs = std::chrono::steady_clock::now() - startupStart;
 
-    while (adapter == NULL) {
-        // Wait for the instance to give us the adapter
-        wgpuInstanceProcessEvents(instance);
+    // Pick the adapter
+    std::vector<AdapterCandidate> candidates = adapter_enumerate(instance);
+    WGPUAdapter adapter = adapter_select(&candidates,&options);
+    if (!adapter) {
+        fprintf(stderr, "Failed to get an adapter\n");
+        return 1;
     }
+    std::chrono::duration<double,std::milli> adapterMs = std::chrono::steady_clock::now() - startupStart;
 
     printf("Got adapter\n");
-
-    WGPUAdapterInfo info{};
-    WGPUStatus s = wgpuAdapterGetInfo(adapter,&info);
-    if (s != WGPUStatus_Success) {
-        fprintf(stderr, "wgpuAdapterGetInfo failed (status %d)\n", (int)s);
-    }
-    printf("VendorID: %x\n", info.vendorID);
-    printf("Vendor: %.*s\n", (int)info.vendor.length, info.vendor.data);
-    printf("Architecture: %.*s\n", (int)info.vendor.length, info.architecture.data);
-    printf("DeviceID: %x\n", info.deviceID);
-    printf("Name: %.*s\n", (int)info.vendor.length, info.device.data);
-    printf("Driver description: %.*s\n", (int)info.vendor.length, info.description.data);
+    adapter_print_info(adapter);
 
     // Get device
     WGPUDeviceDescriptor deviceDesc = {};
     WGPUDevice device = nullptr;
 
+    // Optional features the adapter has and its highest limits
+    std::vector<WGPUFeatureName> requiredFeatures;
+    WGPULimits requiredLimits;
+    device_requirements(adapter,&requiredFeatures,&requiredLimits);
+    deviceDesc.requiredFeatureCount = requiredFeatures.size();
+    deviceDesc.requiredFeatures = requiredFeatures.data();
+    deviceDesc.requiredLimits = &requiredLimits;
+
+    auto callbackMode = WGPUCallbackMode_AllowProcessEvents;
     WGPURequestDeviceCallbackInfo deviceCallbackInfo;
     deviceCallbackInfo.callback = &device_callback;
     deviceCallbackInfo.mode = callbackMode;
@@ -604,9 +1456,13 @@ int main(int argc, char** argv) {
     }
 
     printf("Got device!\n");
+    std::chrono::duration<double,std::milli> deviceMs = std::chrono::steady_clock::now() - startupStart;
+    DeviceCapabilities deviceCaps;
+    device_capabilities_query(device,&deviceCaps);
+    device_capabilities_print(&deviceCaps);
 
-    // Once we have the device, we no longer need the adater
-    wgpuAdapterRelease(adapter);
+    // The adapter stays around until shutdown, the surface capabilities
+    // below still need it
 
     // Queue holds a series of operations to run
     WGPUQueue queue = wgpuDeviceGetQueue(device);
@@ -642,6 +1498,11 @@ int main(int argc, char** argv) {
     }
 
     WGPUTextureFormat preferredFormat = capabilities.formats[0];
+    bool immediatePresent = false;
+    for (size_t i = 0; i < capabilities.presentModeCount; i++) {
+        immediatePresent |= capabilities.presentModes[i] == WGPUPresentMode_Immediate;
+    }
+    wgpuSurfaceCapabilitiesFreeMembers(capabilities);
     config.format = preferredFormat;
 
     config.viewFormatCount = 0;
@@ -652,34 +1513,113 @@ int main(int argc, char** argv) {
     config.presentMode = WGPUPresentMode_Fifo;
     config.alphaMode = WGPUCompositeAlphaMode_Auto;
 
+    // Don't let vsync cap the benchmark if the surface can avoid it
+    if (options.benchmarkFrames > 0 && immediatePresent) {
+        config.presentMode = WGPUPresentMode_Immediate;
+    }
+
+    // The other scenes share one plain material
+    std::vector<MaterialData> materials;
+    std::vector<uint32_t> instanceMaterials;
+    std::vector<InstanceData> scene;
+    if (strcmp(options.scene,"materials") == 0) {
+        scene = build_material_scene(&materials,&instanceMaterials);
+    } else {
+        scene = strcmp(options.scene,"overdraw") == 0 ? build_overdraw_scene() : build_scene();
+        MaterialData plain = {{1.0f, 1.0f, 1.0f, 1.0f}, 1.0f, 0, 0, 0};
+        materials.push_back(plain);
+        instanceMaterials.assign(scene.size(),0);
+    }
     PipelineSetupOutput setup_params = {.height=(uint32_t)fbHeight,.width=(uint32_t)fbWidth};
-    create_buffers(&setup_params,&device,&preferredFormat);
+    resource_registry_set_budget((uint64_t)options.memoryBudgetMB << 20);
+    if (!create_buffers(&setup_params,instance,&device,&preferredFormat,scene,materials,instanceMaterials,&options)) {
+        resource_registry_print("GPU memory budget exceeded during setup");
+        return 1;
+    }
+    resource_registry_print("GPU memory after setup");
+    std::chrono::duration<double,std::milli> setupMs = std::chrono::steady_clock::now() - startupStart;
+    printf("Startup on %s: instance %.1f ms, adapter %.1f ms, device %.1f ms, scene %.1f ms (since launch)\n",
+        webgpu_backend_name(), instanceMs.count(), adapterMs.count(), deviceMs.count(), setupMs.count());
+    printf("Scene: %s, depth pre-pass %s, %s, shader features 0x%x (%s)\n", options.scene,
+        options.depthPrepass ? "on" : "off", options.reverseZ ? "reverse-Z Depth32Float" : "Depth24Plus",
+        options.shaderFeatures, options.uniformBranching ? "uniform branching" : "specialized");
 
     wgpuSurfaceConfigure(surface,&config);
 
-    int fbW, fbH;
-    while (!glfwWindowShouldClose(window)) {
-        main_loop(&surface,&device,&queue,&setup_params);
-        glfwPollEvents();
-        wgpuInstanceProcessEvents(instance);
-        glfwGetFramebufferSize(window, &fbW, &fbH);
-        printf("fb: %dx%d\n", fbW, fbH);
-        sleep(1);
-
+    // Recompile the render shader when its files change. Left off in
+    // benchmark mode so runs stay comparable.
+    ShaderReload* shaderReload = nullptr;
+    if (options.benchmarkFrames == 0) {
+        shaderReload = new ShaderReload();
+        if (!shader_reload_start(shaderReload,instance,device,renderShaderPaths,RENDER_SHADER_FIXED_PATHS)) {
+            fprintf(stderr,"Shader hot reload is not available\n");
+            shader_reload_stop(shaderReload);
+            delete shaderReload;
+            shaderReload = nullptr;
+        }
+    }
 
-#ifdef WEBGPU_BACKEND_DAWN
-        wgpuDeviceTick(device);
-#endif
-#ifdef WEBGPU_BACKEND_WGPU
-        wgpuDevicePoll(device, false, nullptr);
-#endif
+    // This thread only handles window events from here on. Everything that
+    // talks to WebGPU runs on the render thread, so a slow event never holds
+    // up a frame and a slow frame never holds up input.
+    InputQueue* inputQueue = new InputQueue();
+    input_queue_init(inputQueue);
+    InputState inputState;
+    input_state_attach(&inputState,window);
+
+    RenderThreadContext* renderContext = new RenderThreadContext();
+    renderContext->instance = instance;
+    renderContext->surface = surface;
+    renderContext->device = device;
+    renderContext->queue = queue;
+    renderContext->setup = &setup_params;
+    renderContext->shaderReload = shaderReload;
+    renderContext->inputQueue = inputQueue;
+    renderContext->done = false;
+    renderContext->totalFrameMs = 0.0;
+    input_latency_init(&renderContext->latency);
+
+    std::thread renderThread(render_thread,renderContext);
+    while (!renderContext->done) {
+        input_state_poll(&inputState,window,inputQueue,0.01);
     }
+    renderThread.join();
+
+    // The light sweep printed its own results
+    if (options.benchmarkFrames > 0 && options.batchViews > 0) {
+        double msPerFrame = renderContext->totalFrameMs / options.benchmarkFrames;
+        printf("Benchmark: %u frames of %u views, %.3f ms/frame, %.1f views/s\n",
+            options.benchmarkFrames, options.batchViews, msPerFrame, options.batchViews * 1000.0 / msPerFrame);
+    } else if (options.benchmarkFrames > 0 && !options.lightSweep) {
+        FrameStats* stats = &setup_params.frameStats;
+        double pixels = (double)setup_params.width * setup_params.height;
+        double shadedPerFrame = stats->framesRead > 0 ? (double)stats->totalShadedSamples / stats->framesRead : 0.0;
+        printf("Benchmark: %u frames, %.3f ms/frame, %.0f passed samples/frame (%.2fx the pixel count, backend-dependent)\n",
+            options.benchmarkFrames, renderContext->totalFrameMs / options.benchmarkFrames, shadedPerFrame, shadedPerFrame / pixels);
+    }
+    if (options.benchmarkFrames > 0) {
+        material_system_report(&setup_params.materials);
+        std::chrono::duration<double,std::milli> firstFrameMs = renderContext->firstFrameDone - startupStart;
+        printf("Backend %s: first frame done %.1f ms after launch\n", webgpu_backend_name(), firstFrameMs.count());
+    }
+    input_latency_report(&renderContext->latency);
+    delete renderContext;
+    delete inputQueue;
 
     // Cleanup
+    if (shaderReload) {
+        shader_reload_stop(shaderReload);
+        delete shaderReload;
+    }
     glfwDestroyWindow(window);
     glfwTerminate();
-    wgpuTextureViewRelease(setup_params.depthTextureView);
-    wgpuTextureRelease(setup_params.depthTexture);
+    release_buffers(&setup_params);
+    resource_registry_print("GPU memory at shutdown");
+    uint32_t leaked = resource_registry_report_leaks();
+    if (leaked > 0) {
+        fprintf(stderr,"%u GPU resources were never released\n",leaked);
+    }
+    wgpuSurfaceRelease(surface);
     wgpuQueueRelease(queue);
     wgpuDeviceRelease(device);
     wgpuAdapterRelease(adapter);
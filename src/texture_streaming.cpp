@@ -0,0 +1,756 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "texture_streaming.h"
+#include "webgpu_utils.h"
+
+#define MIPGEN_SHADER_PATH "src/mipgen.wgsl"
+
+// Header fields up to and including the sgd offsets, the level index follows
+#define KTX2_HEADER_SIZE 80
+#define KTX2_LEVEL_ENTRY_SIZE 24
+
+// bytesPerRow of texture to buffer copies has to be a multiple of this
+#define COPY_ROW_ALIGNMENT 256
+
+static const uint8_t ktx2Identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+static bool read_file(const char* path, std::vector<uint8_t>* bytes) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    std::streamsize size = file.tellg();
+    file.seekg(0);
+    bytes->resize((size_t)size);
+    return (bool)file.read((char*)bytes->data(), size);
+}
+
+// KTX2 is little-endian, like every platform we run on
+static uint32_t read_u32(const uint8_t* bytes) {
+    uint32_t value;
+    memcpy(&value,bytes,sizeof(value));
+    return value;
+}
+
+static uint64_t read_u64(const uint8_t* bytes) {
+    uint64_t value;
+    memcpy(&value,bytes,sizeof(value));
+    return value;
+}
+
+static WGPUTextureFormat ktx2_format(uint32_t vkFormat) {
+    switch (vkFormat) {
+        case 37:  return WGPUTextureFormat_RGBA8Unorm;     // VK_FORMAT_R8G8B8A8_UNORM
+        case 43:  return WGPUTextureFormat_RGBA8UnormSrgb; // VK_FORMAT_R8G8B8A8_SRGB
+        case 131: // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+        case 133: return WGPUTextureFormat_BC1RGBAUnorm;
+        case 132:
+        case 134: return WGPUTextureFormat_BC1RGBAUnormSrgb;
+        case 137: return WGPUTextureFormat_BC3RGBAUnorm;
+        case 138: return WGPUTextureFormat_BC3RGBAUnormSrgb;
+        case 145: return WGPUTextureFormat_BC7RGBAUnorm;
+        case 146: return WGPUTextureFormat_BC7RGBAUnormSrgb;
+        case 147: return WGPUTextureFormat_ETC2RGB8Unorm;
+        case 148: return WGPUTextureFormat_ETC2RGB8UnormSrgb;
+        case 151: return WGPUTextureFormat_ETC2RGBA8Unorm;
+        case 152: return WGPUTextureFormat_ETC2RGBA8UnormSrgb;
+        default:  return WGPUTextureFormat_Undefined;
+    }
+}
+
+static bool is_compressed(WGPUTextureFormat format) {
+    uint32_t blockSize;
+    texture_format_block_bytes(format,&blockSize);
+    return blockSize > 1;
+}
+
+static WGPUFeatureName compression_feature(WGPUTextureFormat format) {
+    switch (format) {
+        case WGPUTextureFormat_ETC2RGB8Unorm:
+        case WGPUTextureFormat_ETC2RGB8UnormSrgb:
+        case WGPUTextureFormat_ETC2RGBA8Unorm:
+        case WGPUTextureFormat_ETC2RGBA8UnormSrgb:
+            return WGPUFeatureName_TextureCompressionETC2;
+        default:
+            return WGPUFeatureName_TextureCompressionBC;
+    }
+}
+
+static uint32_t mip_size(uint32_t size, uint32_t level) {
+    return (size >> level) > 0 ? size >> level : 1;
+}
+
+static uint32_t full_mip_count(uint32_t width, uint32_t height) {
+    uint32_t largest = width > height ? width : height;
+    uint32_t count = 1;
+    while ((largest >> count) > 0) {
+        count++;
+    }
+    return count;
+}
+
+static TextureLevel make_level(WGPUTextureFormat format, uint32_t width, uint32_t height) {
+    uint32_t blockSize;
+    uint32_t blockBytes = texture_format_block_bytes(format,&blockSize);
+    TextureLevel level = {};
+    level.width = width;
+    level.height = height;
+    level.bytesPerRow = (width + blockSize - 1) / blockSize * blockBytes;
+    level.rows = (height + blockSize - 1) / blockSize;
+    return level;
+}
+
+static uint64_t level_bytes(const TextureLevel& level) {
+    return (uint64_t)level.bytesPerRow * level.rows;
+}
+
+bool texture_load_ktx2(const char* path, TextureSource* source) {
+    std::vector<uint8_t> bytes;
+    if (!read_file(path,&bytes)) {
+        fprintf(stderr,"Could not read %s\n",path);
+        return false;
+    }
+    if (bytes.size() < KTX2_HEADER_SIZE || memcmp(bytes.data(),ktx2Identifier,sizeof(ktx2Identifier)) != 0) {
+        fprintf(stderr,"%s is not a KTX2 file\n",path);
+        return false;
+    }
+
+    const uint8_t* header = bytes.data();
+    uint32_t vkFormat = read_u32(header + 12);
+    uint32_t width = read_u32(header + 20);
+    uint32_t height = read_u32(header + 24);
+    uint32_t depth = read_u32(header + 28);
+    uint32_t layerCount = read_u32(header + 32);
+    uint32_t faceCount = read_u32(header + 36);
+    uint32_t levelCount = read_u32(header + 40);
+    uint32_t supercompression = read_u32(header + 44);
+
+    WGPUTextureFormat format = ktx2_format(vkFormat);
+    if (format == WGPUTextureFormat_Undefined) {
+        fprintf(stderr,"%s: unsupported vkFormat %u\n",path,vkFormat);
+        return false;
+    }
+    if (width == 0 || height == 0 || depth > 1 || layerCount > 1 || faceCount != 1 || supercompression != 0) {
+        fprintf(stderr,"%s: only single 2D images without supercompression are supported\n",path);
+        return false;
+    }
+
+    // levelCount 0 asks the loader to generate the mips, level 0 is still stored
+    uint32_t storedLevels = levelCount > 0 ? levelCount : 1;
+    if (bytes.size() < KTX2_HEADER_SIZE + (size_t)storedLevels * KTX2_LEVEL_ENTRY_SIZE) {
+        fprintf(stderr,"%s: truncated level index\n",path);
+        return false;
+    }
+
+    source->name = path;
+    source->format = format;
+    source->levels.clear();
+    for (uint32_t l = 0; l < storedLevels; l++) {
+        const uint8_t* entry = header + KTX2_HEADER_SIZE + l * KTX2_LEVEL_ENTRY_SIZE;
+        uint64_t offset = read_u64(entry);
+        uint64_t length = read_u64(entry + 8);
+        TextureLevel level = make_level(format,mip_size(width,l),mip_size(height,l));
+        if (length != level_bytes(level)) {
+            fprintf(stderr,"%s: level %u has %llu bytes, expected %llu\n",path,l,
+                (unsigned long long)length,(unsigned long long)level_bytes(level));
+            return false;
+        }
+        // Compared this way round so a huge offset can't wrap past the check
+        if (offset > bytes.size() || length > bytes.size() - offset) {
+            fprintf(stderr,"%s: level %u runs past the end of the file\n",path,l);
+            return false;
+        }
+        level.data.assign(bytes.begin() + offset,bytes.begin() + offset + length);
+        source->levels.push_back(std::move(level));
+    }
+    source->generateMips = storedLevels < full_mip_count(width,height);
+    return true;
+}
+
+bool texture_load_raw(const char* path, uint32_t width, uint32_t height, TextureSource* source) {
+    static const struct {
+        const char* extension;
+        WGPUTextureFormat format;
+    } rawFormats[] = {
+        {".bc1", WGPUTextureFormat_BC1RGBAUnorm},
+        {".bc3", WGPUTextureFormat_BC3RGBAUnorm},
+        {".bc7", WGPUTextureFormat_BC7RGBAUnorm},
+        {".etc2", WGPUTextureFormat_ETC2RGB8Unorm},
+        {".etc2a", WGPUTextureFormat_ETC2RGBA8Unorm},
+    };
+
+    const char* extension = strrchr(path,'.');
+    WGPUTextureFormat format = WGPUTextureFormat_Undefined;
+    for (const auto& raw : rawFormats) {
+        if (extension && strcmp(extension,raw.extension) == 0) {
+            format = raw.format;
+        }
+    }
+    if (format == WGPUTextureFormat_Undefined) {
+        fprintf(stderr,"%s: raw textures need a .bc1, .bc3, .bc7, .etc2 or .etc2a extension\n",path);
+        return false;
+    }
+
+    std::vector<uint8_t> bytes;
+    if (!read_file(path,&bytes)) {
+        fprintf(stderr,"Could not read %s\n",path);
+        return false;
+    }
+
+    // Take as many levels as the file holds
+    source->name = path;
+    source->format = format;
+    source->levels.clear();
+    uint64_t offset = 0;
+    for (uint32_t l = 0; l < full_mip_count(width,height); l++) {
+        TextureLevel level = make_level(format,mip_size(width,l),mip_size(height,l));
+        if (level_bytes(level) > bytes.size() - offset) {
+            break;
+        }
+        level.data.assign(bytes.begin() + offset,bytes.begin() + offset + level_bytes(level));
+        offset += level_bytes(level);
+        source->levels.push_back(std::move(level));
+    }
+    if (source->levels.empty()) {
+        fprintf(stderr,"%s is smaller than one %ux%u level\n",path,width,height);
+        return false;
+    }
+    source->generateMips = source->levels.size() < full_mip_count(width,height);
+    return true;
+}
+
+bool texture_load(const char* spec, TextureSource* source) {
+    const char* size = strrchr(spec,'@');
+    if (size) {
+        uint32_t width = 0, height = 0;
+        if (sscanf(size + 1,"%ux%u",&width,&height) != 2 || width == 0 || height == 0) {
+            fprintf(stderr,"%s: expected path@WIDTHxHEIGHT\n",spec);
+            return false;
+        }
+        std::string path(spec,size - spec);
+        return texture_load_raw(path.c_str(),width,height,source);
+    }
+    return texture_load_ktx2(spec,source);
+}
+
+void texture_generate_checker(TextureSource* source, uint32_t size, const float color[3]) {
+    const uint32_t checkSize = size / 8 > 0 ? size / 8 : 1;
+    uint8_t tint[4] = {(uint8_t)(color[0] * 255.0f), (uint8_t)(color[1] * 255.0f), (uint8_t)(color[2] * 255.0f), 255};
+    uint8_t white[4] = {255, 255, 255, 255};
+
+    TextureLevel level = make_level(WGPUTextureFormat_RGBA8Unorm,size,size);
+    level.data.resize(level_bytes(level));
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            const uint8_t* texel = ((x / checkSize + y / checkSize) & 1) ? tint : white;
+            memcpy(&level.data[(y * size + x) * 4],texel,4);
+        }
+    }
+
+    source->name = "checker";
+    source->format = WGPUTextureFormat_RGBA8Unorm;
+    source->levels.clear();
+    source->levels.push_back(std::move(level));
+    source->generateMips = true;
+}
+
+static WGPUTextureView create_view(WGPUTexture texture, WGPUTextureFormat format, uint32_t baseLevel, uint32_t levelCount) {
+    WGPUTextureViewDescriptor viewDesc = {};
+    viewDesc.nextInChain = nullptr;
+    viewDesc.format = format;
+    viewDesc.dimension = WGPUTextureViewDimension_2D;
+    viewDesc.aspect = WGPUTextureAspect_All;
+    viewDesc.baseArrayLayer = 0;
+    viewDesc.arrayLayerCount = 1;
+    viewDesc.baseMipLevel = baseLevel;
+    viewDesc.mipLevelCount = levelCount;
+    return wgpuTextureCreateView(texture,&viewDesc);
+}
+
+static WGPUTexture create_texture(WGPUDevice device, const char* label, WGPUTextureFormat format, uint32_t width, uint32_t height,
+                                  uint32_t levelCount, WGPUTextureUsage usage) {
+    WGPUTextureDescriptor textureDesc = {};
+    textureDesc.label = {label,WGPU_STRLEN};
+    textureDesc.dimension = WGPUTextureDimension_2D;
+    textureDesc.format = format;
+    textureDesc.mipLevelCount = levelCount;
+    textureDesc.sampleCount = 1;
+    textureDesc.size = {width, height, 1};
+    textureDesc.usage = usage;
+    textureDesc.viewFormatCount = 1;
+    textureDesc.viewFormats = &format;
+    return tracked_create_texture(device,&textureDesc);
+}
+
+static void write_level(WGPUQueue queue, WGPUTexture texture, uint32_t mipLevel, const TextureLevel& level) {
+    WGPUTexelCopyTextureInfo destination = {};
+    destination.texture = texture;
+    destination.mipLevel = mipLevel;
+    destination.origin = {0, 0, 0};
+    destination.aspect = WGPUTextureAspect_All;
+
+    WGPUTexelCopyBufferLayout layout = {};
+    layout.offset = 0;
+    layout.bytesPerRow = level.bytesPerRow;
+    layout.rowsPerImage = level.rows;
+
+    WGPUExtent3D size = {level.width, level.height, 1};
+    wgpuQueueWriteTexture(queue,&destination,level.data.data(),level.data.size(),&layout,&size);
+}
+
+bool texture_streamer_create(TextureStreamer* streamer, WGPUInstance instance, WGPUDevice device, uint64_t budgetBytes) {
+    streamer->instance = instance;
+    streamer->device = device;
+    streamer->queue = wgpuDeviceGetQueue(device);
+    streamer->budgetBytes = budgetBytes;
+    streamer->windowStart = std::chrono::steady_clock::now();
+
+    streamer->placeholder = TextureHandle(create_texture(device,"Texture placeholder",WGPUTextureFormat_RGBA8Unorm,1,1,1,
+        WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst));
+    if (!streamer->placeholder) {
+        return false;
+    }
+    TextureLevel white = make_level(WGPUTextureFormat_RGBA8Unorm,1,1);
+    white.data.assign(4,255);
+    write_level(streamer->queue,streamer->placeholder,0,white);
+    streamer->placeholderView = TextureViewHandle(create_view(streamer->placeholder,WGPUTextureFormat_RGBA8Unorm,0,1));
+
+    WGPUSamplerDescriptor samplerDesc = {};
+    samplerDesc.label = {"Streamed texture sampler",WGPU_STRLEN};
+    samplerDesc.addressModeU = WGPUAddressMode_Repeat;
+    samplerDesc.addressModeV = WGPUAddressMode_Repeat;
+    samplerDesc.addressModeW = WGPUAddressMode_Repeat;
+    samplerDesc.magFilter = WGPUFilterMode_Linear;
+    samplerDesc.minFilter = WGPUFilterMode_Linear;
+    samplerDesc.mipmapFilter = WGPUMipmapFilterMode_Linear;
+    samplerDesc.lodMinClamp = 0.0f;
+    samplerDesc.lodMaxClamp = 32.0f;
+    samplerDesc.compare = WGPUCompareFunction_Undefined;
+    samplerDesc.maxAnisotropy = 1;
+    streamer->sampler = SamplerHandle(wgpuDeviceCreateSampler(device,&samplerDesc));
+
+    // Mip generation: one level in, the next one out
+    WGPUBindGroupLayoutEntry layoutEntries[2] = {};
+    setDefault(layoutEntries[0]);
+    layoutEntries[0].binding = 0;
+    layoutEntries[0].visibility = WGPUShaderStage_Compute;
+    layoutEntries[0].texture.sampleType = WGPUTextureSampleType_Float;
+    layoutEntries[0].texture.viewDimension = WGPUTextureViewDimension_2D;
+    setDefault(layoutEntries[1]);
+    layoutEntries[1].binding = 1;
+    layoutEntries[1].visibility = WGPUShaderStage_Compute;
+    layoutEntries[1].storageTexture.access = WGPUStorageTextureAccess_WriteOnly;
+    layoutEntries[1].storageTexture.format = WGPUTextureFormat_RGBA8Unorm;
+    layoutEntries[1].storageTexture.viewDimension = WGPUTextureViewDimension_2D;
+
+    WGPUBindGroupLayoutDescriptor layoutDesc = {};
+    layoutDesc.label = {"Mip generation layout",WGPU_STRLEN};
+    layoutDesc.entryCount = 2;
+    layoutDesc.entries = layoutEntries;
+    streamer->mipLayout = BindGroupLayoutHandle(wgpuDeviceCreateBindGroupLayout(device,&layoutDesc));
+
+    ShaderModuleHandle module(create_shader_module(device,LoadWGSLShader(MIPGEN_SHADER_PATH),"Mip generation shader"));
+    streamer->mipPipeline = ComputePipelineHandle(create_compute_pipeline(device,streamer->mipLayout,module,"downsample"));
+    return true;
+}
+
+static void mip_readback_callback(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, void* userdata2) {
+    StreamedTexture* texture = (StreamedTexture*)userdata1;
+    std::vector<TextureLevel>& levels = texture->source.levels;
+
+    if (status != WGPUMapAsyncStatus_Success) {
+        // Stream what the file had
+        fprintf(stderr,"Mip readback for %s failed: %.*s\n",texture->source.name.c_str(),(int)message.length,message.data);
+        texture->levelCount = (uint32_t)levels.size();
+    } else {
+        const std::vector<uint64_t>& offsets = texture->mipReadbackOffsets;
+        const uint8_t* mapped = (const uint8_t*)wgpuBufferGetConstMappedRange(texture->mipReadback,0,offsets.back());
+        uint32_t width = levels[0].width;
+        uint32_t height = levels[0].height;
+        for (uint32_t l = (uint32_t)levels.size(), i = 0; l < texture->levelCount; l++, i++) {
+            TextureLevel level = make_level(WGPUTextureFormat_RGBA8Unorm,mip_size(width,l),mip_size(height,l));
+            level.data.resize(level_bytes(level));
+            for (uint32_t row = 0; row < level.rows; row++) {
+                memcpy(&level.data[row * level.bytesPerRow],mapped + offsets[i] + row * texture->mipReadbackRowPitch[i],level.bytesPerRow);
+            }
+            levels.push_back(std::move(level));
+        }
+        wgpuBufferUnmap(texture->mipReadback);
+    }
+
+    texture->mipTexture.reset();
+    texture->mipReadback.reset();
+    texture->mipReadbackOffsets.clear();
+    texture->mipReadbackRowPitch.clear();
+    texture->ready = true;
+}
+
+// Build the missing levels of an RGBA8 texture on the GPU and read them back,
+// so from then on streaming only ever copies finished levels. Returns false
+// if the scratch resources don't fit; the texture then streams what it has.
+static bool generate_mips(TextureStreamer* streamer, StreamedTexture* texture) {
+    const WGPUTextureFormat format = WGPUTextureFormat_RGBA8Unorm;
+    const std::vector<TextureLevel>& levels = texture->source.levels;
+    const uint32_t firstMissing = (uint32_t)levels.size();
+    const uint32_t width = levels[0].width;
+    const uint32_t height = levels[0].height;
+
+    TextureHandle mipTexture(create_texture(streamer->device,"Mip generation texture",format,width,height,texture->levelCount,
+        WGPUTextureUsage_TextureBinding | WGPUTextureUsage_StorageBinding | WGPUTextureUsage_CopySrc | WGPUTextureUsage_CopyDst));
+    if (!mipTexture) {
+        return false;
+    }
+
+    // Rows padded to the copy alignment, one level after the other
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> rowPitch;
+    uint64_t readbackSize = 0;
+    for (uint32_t l = firstMissing; l < texture->levelCount; l++) {
+        uint32_t pitch = (mip_size(width,l) * 4 + COPY_ROW_ALIGNMENT - 1) / COPY_ROW_ALIGNMENT * COPY_ROW_ALIGNMENT;
+        offsets.push_back(readbackSize);
+        rowPitch.push_back(pitch);
+        readbackSize += (uint64_t)pitch * mip_size(height,l);
+    }
+    offsets.push_back(readbackSize);
+
+    WGPUBufferDescriptor bufferDesc = {};
+    bufferDesc.label = {"Mip readback buffer",WGPU_STRLEN};
+    bufferDesc.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
+    bufferDesc.size = readbackSize;
+    bufferDesc.mappedAtCreation = false;
+    BufferHandle readback(tracked_create_buffer(streamer->device,&bufferDesc));
+    if (!readback) {
+        return false;
+    }
+
+    for (uint32_t l = 0; l < firstMissing; l++) {
+        write_level(streamer->queue,mipTexture,l,levels[l]);
+    }
+
+    WGPUCommandEncoderDescriptor encoderDesc = {};
+    encoderDesc.label = {"Mip generation encoder",WGPU_STRLEN};
+    WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(streamer->device,&encoderDesc);
+
+    WGPUComputePassDescriptor passDesc = {};
+    passDesc.label = {"Mip generation pass",WGPU_STRLEN};
+    WGPUComputePassEncoder pass = wgpuCommandEncoderBeginComputePass(encoder,&passDesc);
+    wgpuComputePassEncoderSetPipeline(pass,streamer->mipPipeline);
+    for (uint32_t l = firstMissing; l < texture->levelCount; l++) {
+        TextureViewHandle sourceView(create_view(mipTexture,format,l - 1,1));
+        TextureViewHandle destinationView(create_view(mipTexture,format,l,1));
+
+        WGPUBindGroupEntry entries[2] = {};
+        entries[0].binding = 0;
+        entries[0].textureView = sourceView;
+        entries[1].binding = 1;
+        entries[1].textureView = destinationView;
+        WGPUBindGroupDescriptor bindGroupDesc = {};
+        bindGroupDesc.label = {"Mip generation bind group",WGPU_STRLEN};
+        bindGroupDesc.layout = streamer->mipLayout;
+        bindGroupDesc.entryCount = 2;
+        bindGroupDesc.entries = entries;
+        BindGroupHandle bindGroup(wgpuDeviceCreateBindGroup(streamer->device,&bindGroupDesc));
+
+        // The pass keeps its own references once the bind group is set
+        wgpuComputePassEncoderSetBindGroup(pass,0,bindGroup,0,nullptr);
+        wgpuComputePassEncoderDispatchWorkgroups(pass,(mip_size(width,l) + 7) / 8,(mip_size(height,l) + 7) / 8,1);
+    }
+    wgpuComputePassEncoderEnd(pass);
+    wgpuComputePassEncoderRelease(pass);
+
+    for (uint32_t l = firstMissing, i = 0; l < texture->levelCount; l++, i++) {
+        WGPUTexelCopyTextureInfo source = {};
+        source.texture = mipTexture;
+        source.mipLevel = l;
+        source.origin = {0, 0, 0};
+        source.aspect = WGPUTextureAspect_All;
+
+        WGPUTexelCopyBufferInfo destination = {};
+        destination.buffer = readback;
+        destination.layout.offset = offsets[i];
+        destination.layout.bytesPerRow = rowPitch[i];
+        destination.layout.rowsPerImage = mip_size(height,l);
+
+        WGPUExtent3D size = {mip_size(width,l), mip_size(height,l), 1};
+        wgpuCommandEncoderCopyTextureToBuffer(encoder,&source,&destination,&size);
+    }
+
+    WGPUCommandBufferDescriptor commandDesc = {};
+    commandDesc.label = {"Mip generation commands",WGPU_STRLEN};
+    WGPUCommandBuffer command = wgpuCommandEncoderFinish(encoder,&commandDesc);
+    wgpuCommandEncoderRelease(encoder);
+    wgpuQueueSubmit(streamer->queue,1,&command);
+    wgpuCommandBufferRelease(command);
+
+    texture->mipTexture = std::move(mipTexture);
+    texture->mipReadback = std::move(readback);
+    texture->mipReadbackOffsets = offsets;
+    texture->mipReadbackRowPitch = rowPitch;
+
+    WGPUBufferMapCallbackInfo mapInfo = {};
+    mapInfo.nextInChain = nullptr;
+    mapInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+    mapInfo.callback = &mip_readback_callback;
+    mapInfo.userdata1 = texture;
+    wgpuBufferMapAsync(texture->mipReadback,WGPUMapMode_Read,0,readbackSize,mapInfo);
+    return true;
+}
+
+int texture_streamer_add(TextureStreamer* streamer, TextureSource* source) {
+    WGPUTextureFormat format = source->format;
+    if (is_compressed(format)) {
+        if (!wgpuDeviceHasFeature(streamer->device,compression_feature(format))) {
+            fprintf(stderr,"%s: the device can't sample this compression format, skipping it\n",source->name.c_str());
+            return -1;
+        }
+        // Copies of compressed levels have to cover whole blocks, so stop
+        // before the first level that isn't a multiple of the block size
+        uint32_t usable = 0;
+        while (usable < source->levels.size() && source->levels[usable].width % 4 == 0 && source->levels[usable].height % 4 == 0) {
+            usable++;
+        }
+        if (usable == 0) {
+            fprintf(stderr,"%s: %ux%u is not a multiple of the 4x4 block size\n",source->name.c_str(),
+                source->levels[0].width,source->levels[0].height);
+            return -1;
+        }
+        source->levels.resize(usable);
+        source->generateMips = false;
+    }
+
+    StreamedTexture* texture = new StreamedTexture();
+    texture->source = std::move(*source);
+    texture->levelCount = (uint32_t)texture->source.levels.size();
+    texture->ready = true;
+
+    const TextureLevel& base = texture->source.levels[0];
+    if (texture->source.generateMips && format == WGPUTextureFormat_RGBA8Unorm) {
+        texture->levelCount = full_mip_count(base.width,base.height);
+        texture->ready = false;
+        if (!generate_mips(streamer,texture)) {
+            texture->levelCount = (uint32_t)texture->source.levels.size();
+            texture->ready = true;
+        }
+    }
+    texture->residentLevel = texture->levelCount;
+
+    printf("Texture %s: %ux%u, %u levels%s\n",texture->source.name.c_str(),base.width,base.height,texture->levelCount,
+        texture->ready ? "" : " (generating mips)");
+    streamer->textures.push_back(texture);
+    return (int)streamer->textures.size() - 1;
+}
+
+void texture_streamer_touch(TextureStreamer* streamer, uint32_t index) {
+    if (index < streamer->textures.size()) {
+        streamer->textures[index]->lastUsedFrame = streamer->frame;
+    }
+}
+
+// Replace the GPU texture with one that holds levels level..levelCount-1.
+// Levels both textures share are copied on the GPU, new ones come from the
+// CPU copy. Returns false if the new texture doesn't fit the memory budget.
+static bool set_resident_level(TextureStreamer* streamer, StreamedTexture* texture, uint32_t level) {
+    const std::vector<TextureLevel>& levels = texture->source.levels;
+    const WGPUTextureFormat format = texture->source.format;
+    const uint32_t levelCount = texture->levelCount - level;
+
+    TextureHandle resident(create_texture(streamer->device,texture->source.name.c_str(),format,levels[level].width,levels[level].height,
+        levelCount,WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopySrc | WGPUTextureUsage_CopyDst));
+    if (!resident) {
+        return false;
+    }
+
+    if (texture->texture) {
+        WGPUCommandEncoderDescriptor encoderDesc = {};
+        encoderDesc.label = {"Texture residency encoder",WGPU_STRLEN};
+        WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(streamer->device,&encoderDesc);
+        for (uint32_t l = std::max(level,texture->residentLevel); l < texture->levelCount; l++) {
+            WGPUTexelCopyTextureInfo source = {};
+            source.texture = texture->texture;
+            source.mipLevel = l - texture->residentLevel;
+            source.origin = {0, 0, 0};
+            source.aspect = WGPUTextureAspect_All;
+
+            WGPUTexelCopyTextureInfo destination = source;
+            destination.texture = resident;
+            destination.mipLevel = l - level;
+
+            WGPUExtent3D size = {levels[l].width, levels[l].height, 1};
+            wgpuCommandEncoderCopyTextureToTexture(encoder,&source,&destination,&size);
+        }
+        WGPUCommandBufferDescriptor commandDesc = {};
+        commandDesc.label = {"Texture residency commands",WGPU_STRLEN};
+        WGPUCommandBuffer command = wgpuCommandEncoderFinish(encoder,&commandDesc);
+        wgpuCommandEncoderRelease(encoder);
+        wgpuQueueSubmit(streamer->queue,1,&command);
+        wgpuCommandBufferRelease(command);
+    }
+
+    uint64_t uploaded = 0;
+    for (uint32_t l = level; l < texture->residentLevel; l++) {
+        write_level(streamer->queue,resident,l - level,levels[l]);
+        uploaded += level_bytes(levels[l]);
+    }
+
+    uint64_t residentBytes = 0;
+    for (uint32_t l = level; l < texture->levelCount; l++) {
+        residentBytes += level_bytes(levels[l]);
+    }
+    streamer->residentBytes = streamer->residentBytes - texture->residentBytes + residentBytes;
+    streamer->uploadedBytes += uploaded;
+    streamer->windowUploadedBytes += uploaded;
+    texture->residentBytes = residentBytes;
+
+    // Work already submitted keeps the old texture alive as long as it needs it
+    texture->texture = std::move(resident);
+    texture->view = TextureViewHandle(create_view(texture->texture,format,0,levelCount));
+    texture->residentLevel = level;
+    return true;
+}
+
+// Drop the finest levels of the textures sampled longest ago until bytes
+// more fit the residency budget. Textures sampled this frame and the
+// coarsest level of every texture stay.
+static bool make_room(TextureStreamer* streamer, uint64_t bytes) {
+    while (streamer->residentBytes + bytes > streamer->budgetBytes) {
+        StreamedTexture* victim = nullptr;
+        for (StreamedTexture* texture : streamer->textures) {
+            if (texture->lastUsedFrame == streamer->frame || texture->residentLevel + 1 >= texture->levelCount) {
+                continue;
+            }
+            if (!victim || texture->lastUsedFrame < victim->lastUsedFrame) {
+                victim = texture;
+            }
+        }
+        if (!victim) {
+            return false;
+        }
+
+        // Free everything that is needed from this one texture in one go
+        uint64_t needed = streamer->residentBytes + bytes - streamer->budgetBytes;
+        uint64_t freed = 0;
+        uint32_t level = victim->residentLevel;
+        while (freed < needed && level + 1 < victim->levelCount) {
+            freed += level_bytes(victim->source.levels[level]);
+            level++;
+        }
+        uint32_t evicted = level - victim->residentLevel;
+        if (!set_resident_level(streamer,victim,level)) {
+            return false;
+        }
+        streamer->evictions += evicted;
+        streamer->windowEvictions += evicted;
+    }
+    return true;
+}
+
+void texture_streamer_update(TextureStreamer* streamer) {
+    // Most recently sampled first, they get the upload bandwidth
+    std::vector<StreamedTexture*> order = streamer->textures;
+    std::stable_sort(order.begin(),order.end(),[](const StreamedTexture* a, const StreamedTexture* b) {
+        return a->lastUsedFrame > b->lastUsedFrame;
+    });
+
+    uint64_t uploaded = 0;
+    bool uploadCapReached = false;
+    for (StreamedTexture* texture : order) {
+        if (!texture->ready || uploadCapReached) {
+            continue;
+        }
+        // Textures not sampled this frame only get their coarsest level
+        uint32_t target = texture->lastUsedFrame == streamer->frame ? 0 : texture->levelCount - 1;
+
+        // Finest level within this frame's upload cap. The first level goes
+        // even when it is bigger than the cap on its own.
+        uint32_t level = texture->residentLevel;
+        uint64_t bytes = 0;
+        while (level > target) {
+            uint64_t next = level_bytes(texture->source.levels[level - 1]);
+            if (uploaded + bytes > 0 && uploaded + bytes + next > TEXTURE_UPLOAD_BYTES_PER_FRAME) {
+                uploadCapReached = true;
+                break;
+            }
+            bytes += next;
+            level--;
+        }
+
+        // Settle for coarser levels if the budget can't take all of them
+        while (level < texture->residentLevel && !make_room(streamer,bytes)) {
+            bytes -= level_bytes(texture->source.levels[level]);
+            level++;
+        }
+
+        // A single new texture, copy and submit however many levels came in
+        if (level < texture->residentLevel && set_resident_level(streamer,texture,level)) {
+            uploaded += bytes;
+        }
+    }
+    streamer->frame++;
+}
+
+WGPUTextureView texture_streamer_view(const TextureStreamer* streamer, uint32_t index) {
+    if (index >= streamer->textures.size() || !streamer->textures[index]->view) {
+        return streamer->placeholderView;
+    }
+    return streamer->textures[index]->view;
+}
+
+void texture_streamer_report(TextureStreamer* streamer) {
+    if (streamer->textures.empty()) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - streamer->windowStart).count();
+
+    uint32_t fullResolution = 0;
+    for (const StreamedTexture* texture : streamer->textures) {
+        if (texture->residentLevel == 0) {
+            fullResolution++;
+        }
+    }
+    printf("Textures: %.2f of %.2f MB resident, %u/%zu at full resolution, %.2f MB/s uploaded, %u levels evicted\n",
+        streamer->residentBytes / 1048576.0,streamer->budgetBytes / 1048576.0,fullResolution,streamer->textures.size(),
+        seconds > 0.0 ? streamer->windowUploadedBytes / 1048576.0 / seconds : 0.0,streamer->windowEvictions);
+
+    streamer->windowUploadedBytes = 0;
+    streamer->windowEvictions = 0;
+    streamer->windowStart = now;
+}
+
+void texture_streamer_release(TextureStreamer* streamer) {
+    // A mip readback still in flight writes into its texture when it lands
+    bool pending = true;
+    while (pending) {
+        pending = false;
+        for (const StreamedTexture* texture : streamer->textures) {
+            pending = pending || texture->mipReadback;
+        }
+        if (pending) {
+            wgpuInstanceProcessEvents(streamer->instance);
+#ifdef WEBGPU_BACKEND_DAWN
+            wgpuDeviceTick(streamer->device);
+#endif
+#ifdef WEBGPU_BACKEND_WGPU
+            wgpuDevicePoll(streamer->device, false, nullptr);
+#endif
+        }
+    }
+
+    printf("Textures: %.2f MB uploaded in total, %u levels evicted\n",streamer->uploadedBytes / 1048576.0,streamer->evictions);
+    for (StreamedTexture* texture : streamer->textures) {
+        delete texture;
+    }
+    streamer->textures.clear();
+    streamer->residentBytes = 0;
+    streamer->placeholderView.reset();
+    streamer->placeholder.reset();
+    streamer->sampler.reset();
+    streamer->mipPipeline.reset();
+    streamer->mipLayout.reset();
+    if (streamer->queue) {
+        wgpuQueueRelease(streamer->queue);
+        streamer->queue = nullptr;
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef SIMPLE_WEBGPU_TEXTURE_STREAMING_H
+#define SIMPLE_WEBGPU_TEXTURE_STREAMING_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <webgpu/webgpu.h>
+#include "gpu_resources.h"
+
+// Upload at most this much per frame, but always at least one level
+#define TEXTURE_UPLOAD_BYTES_PER_FRAME (4u << 20)
+
+// One mip level, tightly packed rows of texels (or 4x4 blocks)
+typedef struct TextureLevel {
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerRow;
+    uint32_t rows;
+    std::vector<uint8_t> data;
+} TextureLevel;
+
+// A texture as it sits in CPU memory, finest level first
+typedef struct TextureSource {
+    std::string name;
+    WGPUTextureFormat format;
+    std::vector<TextureLevel> levels;
+    // The file stopped before 1x1. Only RGBA8Unorm can have the rest built
+    // on the GPU; compressed textures just stream the levels they have.
+    bool generateMips;
+} TextureSource;
+
+// KTX2 without supercompression, single 2D image, RGBA8 or BC1/3/7 or ETC2.
+// Returns false and prints why on anything else.
+bool texture_load_ktx2(const char* path, TextureSource* source);
+
+// Headerless block data, every level back to back starting with the finest.
+// The format comes from the extension (.bc1 .bc3 .bc7 .etc2 .etc2a).
+bool texture_load_raw(const char* path, uint32_t width, uint32_t height, TextureSource* source);
+
+// "file.ktx2" or "file.bc7@1024x1024"
+bool texture_load(const char* spec, TextureSource* source);
+
+// RGBA8 checkerboard with only level 0, so the mips get generated
+void texture_generate_checker(TextureSource* source, uint32_t size, const float color[3]);
+
+typedef struct StreamedTexture {
+    TextureSource source;
+    uint32_t levelCount;     // levels that can be streamed
+    uint32_t residentLevel;  // finest level on the GPU, levelCount if none yet
+    bool ready;              // every level is in source (mips generated)
+    TextureHandle texture;   // levels residentLevel..levelCount-1
+    TextureViewHandle view;
+    uint64_t residentBytes;
+    uint64_t lastUsedFrame;
+
+    // In flight while the GPU builds missing mips
+    TextureHandle mipTexture;
+    BufferHandle mipReadback;
+    std::vector<uint64_t> mipReadbackOffsets;
+    std::vector<uint32_t> mipReadbackRowPitch;
+} StreamedTexture;
+
+// Keeps a set of textures partly on the GPU. Levels stream in coarse to fine
+// for the textures sampled recently. When the residency budget runs out,
+// the finest levels of the least recently sampled textures are dropped first.
+// WebGPU has no sparse textures, so changing what is resident means a new,
+// smaller or larger texture. The levels that stay are copied over on the GPU.
+typedef struct TextureStreamer {
+    WGPUInstance instance;
+    WGPUDevice device;
+    WGPUQueue queue;
+    std::vector<StreamedTexture*> textures;
+    uint64_t budgetBytes;
+    uint64_t residentBytes;
+    uint64_t frame;
+
+    BindGroupLayoutHandle mipLayout;
+    ComputePipelineHandle mipPipeline;
+    TextureHandle placeholder; // 1x1 white, bound until a texture has levels
+    TextureViewHandle placeholderView;
+    SamplerHandle sampler;
+
+    uint64_t uploadedBytes;
+    uint64_t windowUploadedBytes;
+    uint32_t evictions;
+    uint32_t windowEvictions;
+    std::chrono::steady_clock::time_point windowStart;
+} TextureStreamer;
+
+// Returns false if the placeholder texture doesn't fit the memory budget
+bool texture_streamer_create(TextureStreamer* streamer, WGPUInstance instance, WGPUDevice device, uint64_t budgetBytes);
+
+// Takes the source over. Returns the texture index, or -1 when the device
+// can't sample the format.
+int texture_streamer_add(TextureStreamer* streamer, TextureSource* source);
+
+// Mark a texture as sampled this frame
+void texture_streamer_touch(TextureStreamer* streamer, uint32_t index);
+
+// Stream levels in and out. Call once per frame before encoding.
+void texture_streamer_update(TextureStreamer* streamer);
+
+// View to bind, the placeholder until the texture has a level on the GPU.
+// Changes whenever the resident levels do, bind groups have to follow.
+WGPUTextureView texture_streamer_view(const TextureStreamer* streamer, uint32_t index);
+
+// Resident memory and upload bandwidth since the last report. Prints nothing
+// when no textures were loaded.
+void texture_streamer_report(TextureStreamer* streamer);
+
+void texture_streamer_release(TextureStreamer* streamer);
+
+#endif // SIMPLE_WEBGPU_TEXTURE_STREAMING_H
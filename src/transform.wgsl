@@ -0,0 +1,37 @@
+// Object space -> clip space. Prepended to every shader that needs to know
+// where geometry lands on screen, so the renderer and the culling pass agree.
+
+// All of these are specialized per pipeline from TransformConstants
+// (shader_variants.h), so they cost nothing at runtime.
+
+// Rotation of the scene around x, in radians
+override TILT: f32 = 0.5;
+// Framebuffer width / height
+override ASPECT: f32 = 640.0 / 480.0;
+// Reverse-Z maps near to 1 and far to 0, which spreads float precision more
+// evenly over the depth range (see RenderOptions::reverseZ)
+override REVERSE_Z: bool = false;
+
+// Object space -> view space, i.e. the scene tilted around x
+fn to_view(p: vec3f) -> vec3f {
+    let alpha = cos(TILT);
+	let beta = sin(TILT);
+	return vec3f(
+		p.x,
+		alpha * p.y + beta * p.z,
+		alpha * p.z - beta * p.y,
+	);
+}
+
+fn project(p: vec3f) -> vec4f {
+	let ratio = ASPECT;
+
+	let pos = to_view(p);
+	let depth = pos.z * 0.5 + 0.5;
+	return vec4f(pos.x, pos.y * ratio, select(depth, 1.0 - depth, REVERSE_Z), 1.0);
+}
+
+// The farther of two depth values for the current depth convention
+fn farther(a: f32, b: f32) -> f32 {
+	return select(max(a, b), min(a, b), REVERSE_Z);
+}
@@ -0,0 +1,160 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "webgpu_utils.h"
+#include "gpu_resources.h"
+
+void error_callback(WGPUPopErrorScopeStatus status, WGPUErrorType type, WGPUStringView message, void* userdata1, void* userdata2) {
+    // Handle the error scope result here
+    if (message.length > 0) {
+        printf("Status: %d, Error type: %d, Message: %.*s\n", (int)status, (int)type, (int)message.length, message.data);
+    }
+}
+
+void pop_error_scope(WGPUDevice device) {
+    WGPUPopErrorScopeCallbackInfo cbInfo = {};
+    cbInfo.callback = &error_callback;
+    cbInfo.nextInChain = nullptr;
+    cbInfo.mode = WGPUCallbackMode_AllowSpontaneous;
+    wgpuDevicePopErrorScope(device,cbInfo);
+}
+
+void setDefault(WGPUStencilFaceState &stencilFaceState) {
+    stencilFaceState.compare = WGPUCompareFunction_Always;
+    stencilFaceState.failOp = WGPUStencilOperation_Keep;
+    stencilFaceState.depthFailOp = WGPUStencilOperation_Keep;
+    stencilFaceState.passOp = WGPUStencilOperation_Keep;
+}
+
+void setDefault(WGPUDepthStencilState &depthStencilState) {
+    depthStencilState.format = WGPUTextureFormat_Undefined;
+    depthStencilState.depthWriteEnabled = WGPUOptionalBool_False;
+    depthStencilState.depthCompare = WGPUCompareFunction_Always;
+    depthStencilState.stencilReadMask = 0xFFFFFFFF;
+    depthStencilState.stencilWriteMask = 0xFFFFFFFF;
+    depthStencilState.depthBias = 0;
+    depthStencilState.depthBiasSlopeScale = 0;
+    depthStencilState.depthBiasClamp = 0;
+    setDefault(depthStencilState.stencilFront);
+    setDefault(depthStencilState.stencilBack);
+}
+
+void setDefault(WGPUBindGroupLayoutEntry &bindingLayout) {
+    bindingLayout.buffer.nextInChain = nullptr;
+    bindingLayout.buffer.type = WGPUBufferBindingType_Undefined;
+    bindingLayout.buffer.hasDynamicOffset = false;
+
+    bindingLayout.sampler.nextInChain = nullptr;
+    bindingLayout.sampler.type = WGPUSamplerBindingType_BindingNotUsed;
+
+    bindingLayout.storageTexture.nextInChain = nullptr;
+    bindingLayout.storageTexture.access = WGPUStorageTextureAccess_BindingNotUsed;
+    bindingLayout.storageTexture.format = WGPUTextureFormat_Undefined;
+    bindingLayout.storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
+
+    bindingLayout.texture.nextInChain = nullptr;
+    bindingLayout.texture.multisampled = false;
+    bindingLayout.texture.sampleType = WGPUTextureSampleType_BindingNotUsed;
+    bindingLayout.texture.viewDimension = WGPUTextureViewDimension_Undefined;
+}
+
+// Adapted from tutorial, thus why it uses C++ functions instead of fopen()/fgets()
+std::string LoadWGSLShader(const std::string& filepath) {
+    std::ifstream file(filepath);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open shader file: " + filepath);
+    }
+
+    std::stringstream buffer;
+    buffer << file.rdbuf();  // Read entire file
+    return buffer.str();
+}
+
+WGPUShaderModule create_shader_module(WGPUDevice device, const std::string& source, const char* label) {
+    WGPUShaderModuleWGSLDescriptor shaderCodeDesc = {};
+    shaderCodeDesc.code = {source.c_str(), source.length()};
+    shaderCodeDesc.chain.next = nullptr;
+    shaderCodeDesc.chain.sType = WGPUSType_ShaderSourceWGSL;
+
+    WGPUShaderModuleDescriptor shaderDesc = {};
+    shaderDesc.nextInChain = &shaderCodeDesc.chain;
+    shaderDesc.label = {label,WGPU_STRLEN};
+    return wgpuDeviceCreateShaderModule(device, &shaderDesc);
+}
+
+WGPUComputePipeline create_compute_pipeline(WGPUDevice device, WGPUBindGroupLayout layout, WGPUShaderModule module, const char* entryPoint,
+                                            size_t constantCount, const WGPUConstantEntry* constants) {
+    WGPUPipelineLayoutDescriptor pipelineLayoutDesc = {};
+    pipelineLayoutDesc.bindGroupLayouts = &layout;
+    pipelineLayoutDesc.bindGroupLayoutCount = 1;
+    WGPUPipelineLayout pipelineLayout = wgpuDeviceCreatePipelineLayout(device,&pipelineLayoutDesc);
+
+    WGPUComputePipelineDescriptor computeDesc = {};
+    computeDesc.label = {entryPoint,WGPU_STRLEN};
+    computeDesc.layout = pipelineLayout;
+    computeDesc.compute.module = module;
+    computeDesc.compute.entryPoint = {entryPoint,WGPU_STRLEN};
+    computeDesc.compute.constantCount = constantCount;
+    computeDesc.compute.constants = constants;
+    WGPUComputePipeline pipeline = wgpuDeviceCreateComputePipeline(device,&computeDesc);
+
+    // The pipeline keeps its own reference to the layout
+    wgpuPipelineLayoutRelease(pipelineLayout);
+    return pipeline;
+}
+
+WGPUBuffer create_buffer_with_data(WGPUDevice device, const char* label, WGPUBufferUsage usage, const void* data, uint64_t size) {
+    // Mapped ranges and buffer sizes have to be multiples of 4 bytes
+    uint64_t paddedSize = (size + 3) & ~(uint64_t)3;
+
+    WGPUBufferDescriptor bufferDesc = {};
+    bufferDesc.label = {label,WGPU_STRLEN};
+    bufferDesc.usage = usage;
+    bufferDesc.nextInChain = nullptr;
+    bufferDesc.size = paddedSize;
+    bufferDesc.mappedAtCreation = true;
+    WGPUBuffer buffer = tracked_create_buffer(device,&bufferDesc);
+    if (!buffer) {
+        return nullptr;
+    }
+
+    void* bufferAddr = wgpuBufferGetMappedRange(buffer,0,paddedSize);
+    memset(bufferAddr,0,paddedSize);
+    memcpy(bufferAddr,data,size);
+    wgpuBufferUnmap(buffer);
+    return buffer;
+}
+
+WGPUBuffer create_empty_buffer(WGPUDevice device, const char* label, WGPUBufferUsage usage, uint64_t size) {
+    WGPUBufferDescriptor bufferDesc = {};
+    bufferDesc.label = {label,WGPU_STRLEN};
+    bufferDesc.usage = usage;
+    bufferDesc.nextInChain = nullptr;
+    bufferDesc.size = size;
+    bufferDesc.mappedAtCreation = false;
+    return tracked_create_buffer(device,&bufferDesc);
+}
+
+WGPUBindGroupLayoutEntry buffer_layout_entry(uint32_t binding, WGPUShaderStage visibility, WGPUBufferBindingType type) {
+    WGPUBindGroupLayoutEntry entry = {};
+    setDefault(entry);
+    entry.binding = binding;
+    entry.visibility = visibility;
+    entry.buffer.type = type;
+    return entry;
+}
+
+WGPUBindGroupEntry buffer_entry(uint32_t binding, WGPUBuffer buffer, uint64_t size) {
+    WGPUBindGroupEntry entry = {};
+    entry.binding = binding;
+    entry.buffer = buffer;
+    entry.offset = 0;
+    entry.size = size;
+    return entry;
+}
+
+uint32_t workgroup_count(uint32_t items, uint32_t groupSize) {
+    return (items + groupSize - 1) / groupSize;
+}
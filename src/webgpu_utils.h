@@ -0,0 +1,43 @@
+#ifndef SIMPLE_WEBGPU_UTILS_H
+#define SIMPLE_WEBGPU_UTILS_H
+
+#include <string>
+#include <webgpu/webgpu.h>
+
+// Small helpers shared by the renderer and its compute subsystems
+
+void error_callback(WGPUPopErrorScopeStatus status, WGPUErrorType type, WGPUStringView message, void* userdata1, void* userdata2);
+
+// Pop the current error scope and print whatever it caught
+void pop_error_scope(WGPUDevice device);
+
+void setDefault(WGPUStencilFaceState &stencilFaceState);
+void setDefault(WGPUDepthStencilState &depthStencilState);
+void setDefault(WGPUBindGroupLayoutEntry &bindingLayout);
+
+std::string LoadWGSLShader(const std::string& filepath);
+
+// Compile WGSL source into a shader module
+WGPUShaderModule create_shader_module(WGPUDevice device, const std::string& source, const char* label);
+
+// Compute pipeline with a single bind group layout, optionally specializing override constants
+WGPUComputePipeline create_compute_pipeline(WGPUDevice device, WGPUBindGroupLayout layout, WGPUShaderModule module, const char* entryPoint,
+                                            size_t constantCount = 0, const WGPUConstantEntry* constants = nullptr);
+
+// Create a buffer and fill it through a mapping at creation (size is rounded up
+// to 4 bytes). Tracked by the resource registry, returns nullptr over budget.
+WGPUBuffer create_buffer_with_data(WGPUDevice device, const char* label, WGPUBufferUsage usage, const void* data, uint64_t size);
+
+// Uninitialized buffer, tracked like the one above
+WGPUBuffer create_empty_buffer(WGPUDevice device, const char* label, WGPUBufferUsage usage, uint64_t size);
+
+// Bind group layout entry for a buffer binding
+WGPUBindGroupLayoutEntry buffer_layout_entry(uint32_t binding, WGPUShaderStage visibility, WGPUBufferBindingType type);
+
+// Bind group entry for a buffer, the whole of it unless size says otherwise
+WGPUBindGroupEntry buffer_entry(uint32_t binding, WGPUBuffer buffer, uint64_t size = WGPU_WHOLE_SIZE);
+
+// Workgroups needed to cover items with groupSize invocations each
+uint32_t workgroup_count(uint32_t items, uint32_t groupSize);
+
+#endif // SIMPLE_WEBGPU_UTILS_H
@@ -0,0 +1,17 @@
+#ifndef SIMPLE_WEBGPU_TEST_CHECK_H
+#define SIMPLE_WEBGPU_TEST_CHECK_H
+
+#include <cstdio>
+
+// The tests are plain executables. CHECK prints what failed and carries on,
+// and main returns test_failures so CTest marks the test failed.
+static int test_failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr,"%s:%d: CHECK(%s) failed\n",__FILE__,__LINE__,#condition); \
+        test_failures++; \
+    } \
+} while (0)
+
+#endif // SIMPLE_WEBGPU_TEST_CHECK_H
@@ -0,0 +1,114 @@
+#include <cstdint>
+#include <vector>
+#include "bind_group_cache.h"
+#include "check.h"
+
+// Stand-ins, only compared and stored, never passed to WebGPU
+template <typename Handle>
+static Handle fake(uintptr_t id) {
+    return (Handle)(id * 16);
+}
+
+static std::vector<WGPUBindGroupEntry> scene_entries() {
+    std::vector<WGPUBindGroupEntry> entries(3);
+    for (uint32_t i = 0; i < 3; i++) {
+        entries[i] = {};
+        entries[i].binding = i;
+    }
+    entries[0].buffer = fake<WGPUBuffer>(1);
+    entries[0].size = 256;
+    entries[1].buffer = fake<WGPUBuffer>(2);
+    entries[1].offset = 512;
+    entries[1].size = 64;
+    entries[2].textureView = fake<WGPUTextureView>(3);
+    return entries;
+}
+
+static WGPUBindGroupDescriptor descriptor_of(const std::vector<WGPUBindGroupEntry>& entries, const char* label) {
+    WGPUBindGroupDescriptor descriptor = {};
+    descriptor.label = {label,WGPU_STRLEN};
+    descriptor.layout = fake<WGPUBindGroupLayout>(1);
+    descriptor.entryCount = entries.size();
+    descriptor.entries = entries.data();
+    return descriptor;
+}
+
+static BindGroupCacheEntry cache_entry(const WGPUBindGroupDescriptor* descriptor, WGPUBindGroup bindGroup) {
+    BindGroupCacheEntry entry;
+    entry.layout = descriptor->layout;
+    entry.entries.assign(descriptor->entries,descriptor->entries + descriptor->entryCount);
+    entry.bindGroup = bindGroup;
+    entry.lastUsedFrame = 0;
+    return entry;
+}
+
+static void test_equal_contents() {
+    // Separate arrays and labels, same contents
+    std::vector<WGPUBindGroupEntry> a = scene_entries();
+    std::vector<WGPUBindGroupEntry> b = scene_entries();
+    WGPUBindGroupDescriptor descA = descriptor_of(a,"first");
+    WGPUBindGroupDescriptor descB = descriptor_of(b,"second");
+    CHECK(bind_group_cache_hash(&descA) == bind_group_cache_hash(&descB));
+    BindGroupCacheEntry entry = cache_entry(&descA,fake<WGPUBindGroup>(1));
+    CHECK(bind_group_cache_matches(&entry,&descB));
+}
+
+// Every field that changes what the bind group holds makes it a different one
+static void test_different_contents() {
+    std::vector<WGPUBindGroupEntry> base = scene_entries();
+    WGPUBindGroupDescriptor baseDesc = descriptor_of(base,"base");
+    BindGroupCacheEntry entry = cache_entry(&baseDesc,fake<WGPUBindGroup>(1));
+    uint64_t baseHash = bind_group_cache_hash(&baseDesc);
+
+    for (int change = 0; change < 6; change++) {
+        std::vector<WGPUBindGroupEntry> entries = scene_entries();
+        switch (change) {
+            case 0: entries[0].binding = 7; break;
+            case 1: entries[0].buffer = fake<WGPUBuffer>(9); break;
+            case 2: entries[1].offset = 768; break;
+            case 3: entries[1].size = 128; break;
+            case 4: entries[2].textureView = fake<WGPUTextureView>(9); break;
+            case 5: entries[2].sampler = fake<WGPUSampler>(9); break;
+        }
+        WGPUBindGroupDescriptor desc = descriptor_of(entries,"changed");
+        CHECK(bind_group_cache_hash(&desc) != baseHash);
+        CHECK(!bind_group_cache_matches(&entry,&desc));
+    }
+
+    WGPUBindGroupDescriptor layout = baseDesc;
+    layout.layout = fake<WGPUBindGroupLayout>(2);
+    CHECK(bind_group_cache_hash(&layout) != baseHash);
+    CHECK(!bind_group_cache_matches(&entry,&layout));
+
+    WGPUBindGroupDescriptor fewer = baseDesc;
+    fewer.entryCount = 2;
+    CHECK(bind_group_cache_hash(&fewer) != baseHash);
+    CHECK(!bind_group_cache_matches(&entry,&fewer));
+}
+
+// A hit returns the cached bind group and keeps it alive through end_frame
+static void test_lookup() {
+    BindGroupCache cache;
+    bind_group_cache_init(&cache,nullptr);
+    std::vector<WGPUBindGroupEntry> entries = scene_entries();
+    WGPUBindGroupDescriptor desc = descriptor_of(entries,"cached");
+    cache.entries[bind_group_cache_hash(&desc)].push_back(cache_entry(&desc,fake<WGPUBindGroup>(1)));
+
+    for (uint64_t frame = 0; frame < 3; frame++) {
+        std::vector<WGPUBindGroupEntry> again = scene_entries();
+        WGPUBindGroupDescriptor againDesc = descriptor_of(again,"again");
+        CHECK(bind_group_cache_get(&cache,&againDesc) == fake<WGPUBindGroup>(1));
+        bind_group_cache_end_frame(&cache);
+    }
+    CHECK(cache.hits == 3);
+    CHECK(cache.created == 0);
+    CHECK(cache.released == 0);
+    CHECK(cache.entries.size() == 1);
+}
+
+int main() {
+    test_equal_contents();
+    test_different_contents();
+    test_lookup();
+    return test_failures;
+}
@@ -0,0 +1,89 @@
+#include <vector>
+#include "materials.h"
+#include "check.h"
+
+static void test_draw_key_order() {
+    // Pipeline first, then bind group, then depth
+    CHECK(material_draw_key(0,0,1.0f) < material_draw_key(0,1,0.0f));
+    CHECK(material_draw_key(0,0xffff,1.0f) < material_draw_key(1,0,0.0f));
+    CHECK(material_draw_key(2,1,0.25f) < material_draw_key(2,1,0.5f));
+    CHECK(material_draw_key(2,1,0.5f) < material_draw_key(2,1,1.0f));
+    // Behind the near plane sorts as 0 instead of wrapping to the back
+    CHECK(material_draw_key(0,0,-0.5f) == material_draw_key(0,0,0.0f));
+    CHECK(material_draw_key(0,0,-0.5f) < material_draw_key(0,0,0.001f));
+    // The slots can be read back from the top 32 bits
+    CHECK(material_draw_key(5,3,0.75f) >> 32 == ((5ull << 16) | 3));
+}
+
+static MaterialData material(uint32_t features, uint32_t textureSlot) {
+    MaterialData data = {};
+    data.features = features;
+    data.textureSlot = textureSlot;
+    return data;
+}
+
+static MaterialSystem test_system(const std::vector<uint32_t>& instanceMaterials, const std::vector<float>& depths,
+                                  bool sortDraws) {
+    MaterialSystem system = {};
+    system.materials = {
+        material(0,1),                                              // pipeline 0, no texture so bind group 0
+        material(SHADER_FEATURE_TEXTURE,1),                         // pipeline 4, bind group 1
+        material(SHADER_FEATURE_TEXTURE,0),                         // pipeline 4, bind group 0
+        material(SHADER_FEATURE_LIGHTING,0),                        // pipeline 1
+        material(SHADER_FEATURE_LIGHTING | SHADER_FEATURE_LIGHTS,1) // LIGHTS is masked off, pipeline 1
+    };
+    system.materialCount = (uint32_t)system.materials.size();
+    system.instanceMaterials = instanceMaterials;
+    system.instanceDepths = depths;
+    system.instanceCount = (uint32_t)instanceMaterials.size();
+    system.cpuDraws = true;
+    system.sortDraws = sortDraws;
+    return system;
+}
+
+static bool same_run(const MaterialRun& run, uint32_t firstInstance, uint32_t instanceCount, uint32_t pipelineSlot,
+                     uint32_t bindGroupSlot) {
+    return run.firstInstance == firstInstance && run.instanceCount == instanceCount &&
+        run.pipelineSlot == pipelineSlot && run.bindGroupSlot == bindGroupSlot;
+}
+
+static void test_sorted_runs() {
+    MaterialSystem system = test_system({1, 0, 3, 1, 2, 0, 4, 0}, {0.5f, 0.9f, 0.2f, 0.1f, 0.3f, 0.1f, 0.05f, -0.5f}, true);
+    material_system_sort_draws(&system);
+
+    CHECK(system.drawOrder == std::vector<uint32_t>({7, 5, 1, 6, 2, 4, 3, 0}));
+    CHECK(system.runs.size() == 4);
+    if (system.runs.size() == 4) {
+        CHECK(same_run(system.runs[0],0,3,0,0));
+        CHECK(same_run(system.runs[1],3,2,1,0));
+        CHECK(same_run(system.runs[2],5,1,4,0));
+        CHECK(same_run(system.runs[3],6,2,4,1));
+    }
+}
+
+static void test_unsorted_runs() {
+    // Scene order, only neighbours with the same state merge
+    MaterialSystem system = test_system({0, 0, 1, 3, 4, 0}, {0.5f, 0.1f, 0.2f, 0.3f, 0.4f, 0.6f}, false);
+    material_system_sort_draws(&system);
+
+    CHECK(system.drawOrder == std::vector<uint32_t>({0, 1, 2, 3, 4, 5}));
+    CHECK(system.runs.size() == 4);
+    if (system.runs.size() == 4) {
+        CHECK(same_run(system.runs[0],0,2,0,0));
+        CHECK(same_run(system.runs[1],2,1,4,1));
+        CHECK(same_run(system.runs[2],3,2,1,0));
+        CHECK(same_run(system.runs[3],5,1,0,0));
+    }
+
+    // Built again every frame, not appended to
+    material_system_sort_draws(&system);
+    CHECK(system.runs.size() == 4);
+    CHECK(system.drawOrder.size() == 6);
+}
+
+int main() {
+    test_draw_key_order();
+    test_sorted_runs();
+    test_unsorted_runs();
+    return test_failures;
+}
@@ -0,0 +1,119 @@
+#include <climits>
+#include <thread>
+#include "input_thread.h"
+#include "check.h"
+
+static InputSnapshot snapshot_with(uint32_t buttons) {
+    InputSnapshot snapshot = {};
+    snapshot.buttons = buttons;
+    return snapshot;
+}
+
+static void test_empty() {
+    InputQueue queue;
+    input_queue_init(&queue);
+    InputSnapshot out = snapshot_with(123);
+    CHECK(!input_queue_pop(&queue,&out));
+    CHECK(out.buttons == 123); // untouched
+
+    InputSnapshot in = snapshot_with(1);
+    CHECK(input_queue_push(&queue,&in));
+    CHECK(input_queue_pop(&queue,&out));
+    CHECK(out.buttons == 1);
+    CHECK(!input_queue_pop(&queue,&out));
+}
+
+static void test_full() {
+    InputQueue queue;
+    input_queue_init(&queue);
+    for (uint32_t i = 0; i < INPUT_QUEUE_SIZE; i++) {
+        InputSnapshot in = snapshot_with(i);
+        CHECK(input_queue_push(&queue,&in));
+    }
+    InputSnapshot extra = snapshot_with(INPUT_QUEUE_SIZE);
+    CHECK(!input_queue_push(&queue,&extra));
+
+    // One pop makes room for exactly one more
+    InputSnapshot out;
+    CHECK(input_queue_pop(&queue,&out));
+    CHECK(out.buttons == 0);
+    CHECK(input_queue_push(&queue,&extra));
+    CHECK(!input_queue_push(&queue,&extra));
+
+    for (uint32_t i = 1; i <= INPUT_QUEUE_SIZE; i++) {
+        CHECK(input_queue_pop(&queue,&out));
+        CHECK(out.buttons == i);
+    }
+    CHECK(!input_queue_pop(&queue,&out));
+}
+
+// Slots wrap every INPUT_QUEUE_SIZE pushes and the counters wrap at 2^32
+static void test_wraparound() {
+    InputQueue queue;
+    input_queue_init(&queue);
+    queue.head.store(UINT_MAX - 5);
+    queue.tail.store(UINT_MAX - 5);
+
+    uint32_t pushed = 0;
+    uint32_t popped = 0;
+    InputSnapshot out;
+    for (uint32_t round = 0; round < 3 * INPUT_QUEUE_SIZE; round++) {
+        // Keep the queue between half and completely full
+        while (pushed - popped < INPUT_QUEUE_SIZE) {
+            InputSnapshot in = snapshot_with(pushed);
+            CHECK(input_queue_push(&queue,&in));
+            pushed++;
+        }
+        for (uint32_t i = 0; i < INPUT_QUEUE_SIZE / 2; i++) {
+            CHECK(input_queue_pop(&queue,&out));
+            CHECK(out.buttons == popped);
+            popped++;
+        }
+    }
+    CHECK(queue.head.load() < UINT_MAX - 5); // both counters have wrapped
+    while (input_queue_pop(&queue,&out)) {
+        CHECK(out.buttons == popped);
+        popped++;
+    }
+    CHECK(popped == pushed);
+}
+
+// One producer and one consumer, as the main and render threads use it
+static void test_threads() {
+    static InputQueue queue;
+    input_queue_init(&queue);
+    const uint32_t count = 100000;
+
+    std::thread producer([&]() {
+        for (uint32_t i = 0; i < count; ) {
+            InputSnapshot in = snapshot_with(i);
+            if (input_queue_push(&queue,&in)) {
+                i++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    uint32_t expected = 0;
+    bool ordered = true;
+    InputSnapshot out;
+    while (expected < count) {
+        if (input_queue_pop(&queue,&out)) {
+            ordered = ordered && out.buttons == expected;
+            expected++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    CHECK(ordered);
+    CHECK(!input_queue_pop(&queue,&out));
+}
+
+int main() {
+    test_empty();
+    test_full();
+    test_wraparound();
+    test_threads();
+    return test_failures;
+}
@@ -0,0 +1,94 @@
+#include <cstdint>
+#include "shader_variants.h"
+#include "check.h"
+
+// Stand-ins the cache stores and hands back without calling into WebGPU
+static WGPURenderPipeline fake_pipeline(uintptr_t id) {
+    return (WGPURenderPipeline)(id * 16);
+}
+
+static ScenePipelineKey base_key() {
+    ScenePipelineKey key;
+    scene_pipeline_key_init(&key);
+    key.features = SHADER_FEATURE_LIGHTING;
+    key.depthWrite = 1;
+    key.depthCompare = WGPUCompareFunction_Less;
+    key.colorFormat = WGPUTextureFormat_BGRA8Unorm;
+    key.depthFormat = WGPUTextureFormat_Depth24Plus;
+    key.transform = {0.5f, 1.5f, 0};
+    return key;
+}
+
+static PipelineCache empty_cache() {
+    PipelineCache cache = {};
+    return cache;
+}
+
+static void test_equal_keys_hit() {
+    PipelineCache cache = empty_cache();
+    ScenePipelineKey key = base_key();
+    pipeline_cache_insert(&cache,&key,fake_pipeline(1));
+
+    // Built separately, same contents
+    ScenePipelineKey again = base_key();
+    CHECK(pipeline_cache_get(&cache,&again) == fake_pipeline(1));
+    CHECK(cache.hits == 1);
+    CHECK(cache.variantCount == 1);
+}
+
+static void test_different_keys_miss() {
+    PipelineCache cache = empty_cache();
+    ScenePipelineKey key = base_key();
+    pipeline_cache_insert(&cache,&key,fake_pipeline(1));
+
+    ScenePipelineKey compare = base_key();
+    compare.depthCompare = WGPUCompareFunction_Greater;
+    ScenePipelineKey aspect = base_key();
+    aspect.transform.aspect = 2.0f;
+    ScenePipelineKey features = base_key();
+    features.features |= SHADER_FEATURE_FOG;
+    ScenePipelineKey branching = base_key();
+    branching.uniformBranching = 1;
+    pipeline_cache_insert(&cache,&compare,fake_pipeline(2));
+    pipeline_cache_insert(&cache,&aspect,fake_pipeline(3));
+    pipeline_cache_insert(&cache,&features,fake_pipeline(4));
+    pipeline_cache_insert(&cache,&branching,fake_pipeline(5));
+    CHECK(cache.variantCount == 5);
+
+    CHECK(pipeline_cache_get(&cache,&key) == fake_pipeline(1));
+    CHECK(pipeline_cache_get(&cache,&compare) == fake_pipeline(2));
+    CHECK(pipeline_cache_get(&cache,&aspect) == fake_pipeline(3));
+    CHECK(pipeline_cache_get(&cache,&features) == fake_pipeline(4));
+    CHECK(pipeline_cache_get(&cache,&branching) == fake_pipeline(5));
+    CHECK(cache.hits == 5);
+}
+
+// Depth-only pipelines have no fragment stage, so the fragment switches
+// and color format don't matter
+static void test_depth_only_normalized() {
+    PipelineCache cache = empty_cache();
+    ScenePipelineKey depth = base_key();
+    depth.depthOnly = 1;
+    pipeline_cache_insert(&cache,&depth,fake_pipeline(1));
+
+    ScenePipelineKey other = depth;
+    other.features = SHADER_FEATURE_FOG | SHADER_FEATURE_TEXTURE;
+    other.uniformBranching = 1;
+    other.clusteredLights = 1;
+    other.colorFormat = WGPUTextureFormat_RGBA8Unorm;
+    CHECK(pipeline_cache_get(&cache,&other) == fake_pipeline(1));
+    CHECK(cache.variantCount == 1);
+
+    // Depth state still does
+    other.depthCompare = WGPUCompareFunction_Equal;
+    pipeline_cache_insert(&cache,&other,fake_pipeline(2));
+    CHECK(cache.variantCount == 2);
+    CHECK(pipeline_cache_get(&cache,&depth) == fake_pipeline(1));
+}
+
+int main() {
+    test_equal_keys_hit();
+    test_different_keys_miss();
+    test_depth_only_normalized();
+    return test_failures;
+}
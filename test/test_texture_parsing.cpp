@@ -0,0 +1,199 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "gpu_resources.h"
+#include "texture_streaming.h"
+#include "check.h"
+
+// Written to the working directory, which CTest sets to the build directory
+#define KTX2_TEST_PATH "test_texture_parsing.ktx2"
+#define RAW_TEST_PATH "test_texture_parsing.bc7"
+
+typedef struct Ktx2Level {
+    uint64_t offset;
+    uint64_t length;
+} Ktx2Level;
+
+static void put_u32(std::vector<uint8_t>* bytes, size_t at, uint32_t value) {
+    memcpy(bytes->data() + at,&value,sizeof(value));
+}
+
+static void put_u64(std::vector<uint8_t>* bytes, size_t at, uint64_t value) {
+    memcpy(bytes->data() + at,&value,sizeof(value));
+}
+
+static void write_file(const char* path, const std::vector<uint8_t>& bytes) {
+    FILE* file = fopen(path,"wb");
+    fwrite(bytes.data(),1,bytes.size(),file);
+    fclose(file);
+}
+
+// 80 byte header and the level index, no DFD or key/value data
+static std::vector<uint8_t> ktx2_header(uint32_t vkFormat, uint32_t width, uint32_t height, uint32_t levelCount,
+                                        const std::vector<Ktx2Level>& levels) {
+    static const uint8_t identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+    std::vector<uint8_t> bytes(80 + levels.size() * 24,0);
+    memcpy(bytes.data(),identifier,sizeof(identifier));
+    put_u32(&bytes,12,vkFormat);
+    put_u32(&bytes,16,1);
+    put_u32(&bytes,20,width);
+    put_u32(&bytes,24,height);
+    put_u32(&bytes,36,1); // faceCount
+    put_u32(&bytes,40,levelCount);
+    for (size_t l = 0; l < levels.size(); l++) {
+        put_u64(&bytes,80 + l * 24,levels[l].offset);
+        put_u64(&bytes,80 + l * 24 + 8,levels[l].length);
+        put_u64(&bytes,80 + l * 24 + 16,levels[l].length);
+    }
+    return bytes;
+}
+
+// RGBA8 4x4 with its 2x2 and 1x1 mips, level data right after the index
+static std::vector<uint8_t> rgba8_ktx2() {
+    const uint64_t dataStart = 80 + 3 * 24;
+    std::vector<uint8_t> bytes = ktx2_header(37,4,4,3,{{dataStart, 64}, {dataStart + 64, 16}, {dataStart + 80, 4}});
+    for (uint32_t i = 0; i < 84; i++) {
+        bytes.push_back((uint8_t)i);
+    }
+    return bytes;
+}
+
+static bool load_ktx2(const std::vector<uint8_t>& bytes, TextureSource* source) {
+    write_file(KTX2_TEST_PATH,bytes);
+    return texture_load_ktx2(KTX2_TEST_PATH,source);
+}
+
+static void test_ktx2_valid() {
+    TextureSource source;
+    CHECK(load_ktx2(rgba8_ktx2(),&source));
+    CHECK(source.format == WGPUTextureFormat_RGBA8Unorm);
+    CHECK(source.levels.size() == 3);
+    CHECK(!source.generateMips);
+    if (source.levels.size() == 3) {
+        CHECK(source.levels[0].width == 4 && source.levels[0].bytesPerRow == 16 && source.levels[0].rows == 4);
+        CHECK(source.levels[1].data.size() == 16 && source.levels[1].data[0] == 64);
+        CHECK(source.levels[2].width == 1 && source.levels[2].data.size() == 4 && source.levels[2].data[0] == 80);
+    }
+
+    // levelCount 0 still stores level 0 and asks for the rest to be generated
+    std::vector<uint8_t> bytes = ktx2_header(37,4,4,0,{{80 + 24, 64}});
+    bytes.resize(bytes.size() + 64,0);
+    CHECK(load_ktx2(bytes,&source));
+    CHECK(source.levels.size() == 1);
+    CHECK(source.generateMips);
+}
+
+static void test_ktx2_truncated() {
+    std::vector<uint8_t> bytes = rgba8_ktx2();
+    TextureSource source;
+
+    std::vector<uint8_t> header(bytes.begin(),bytes.begin() + 40);
+    CHECK(!load_ktx2(header,&source));
+
+    // Header complete, level index cut short
+    std::vector<uint8_t> index(bytes.begin(),bytes.begin() + 80 + 24);
+    CHECK(!load_ktx2(index,&source));
+
+    // Index complete, last level's data missing
+    std::vector<uint8_t> data(bytes.begin(),bytes.end() - 1);
+    CHECK(!load_ktx2(data,&source));
+
+    std::vector<uint8_t> notKtx2 = bytes;
+    notKtx2[1] = 'X';
+    CHECK(!load_ktx2(notKtx2,&source));
+}
+
+static void test_ktx2_bad_levels() {
+    TextureSource source;
+    const uint64_t dataStart = 80 + 3 * 24;
+
+    // Length doesn't match the level's size
+    std::vector<uint8_t> bytes = ktx2_header(37,4,4,3,{{dataStart, 64}, {dataStart + 64, 12}, {dataStart + 76, 4}});
+    bytes.resize(bytes.size() + 84,0);
+    CHECK(!load_ktx2(bytes,&source));
+
+    // Right length, but past the end of the file
+    bytes = ktx2_header(37,4,4,3,{{dataStart, 64}, {dataStart + 64, 16}, {dataStart + 84, 4}});
+    bytes.resize(bytes.size() + 84,0);
+    CHECK(!load_ktx2(bytes,&source));
+
+    // offset + length wraps around to a small number
+    bytes = ktx2_header(37,4,4,3,{{dataStart, 64}, {UINT64_MAX - 7, 16}, {dataStart + 80, 4}});
+    bytes.resize(bytes.size() + 84,0);
+    CHECK(!load_ktx2(bytes,&source));
+
+    // Unsupported vkFormat (R8_UNORM)
+    bytes = rgba8_ktx2();
+    put_u32(&bytes,12,9);
+    CHECK(!load_ktx2(bytes,&source));
+}
+
+static void test_raw() {
+    TextureSource source;
+
+    // BC7 8x8: 64 bytes for level 0, 16 for every level from 4x4 down.
+    // Two whole levels and part of a third.
+    write_file(RAW_TEST_PATH,std::vector<uint8_t>(64 + 16 + 8,0));
+    CHECK(texture_load_raw(RAW_TEST_PATH,8,8,&source));
+    CHECK(source.format == WGPUTextureFormat_BC7RGBAUnorm);
+    CHECK(source.levels.size() == 2);
+    CHECK(source.generateMips);
+
+    write_file(RAW_TEST_PATH,std::vector<uint8_t>(64 + 3 * 16,0));
+    CHECK(texture_load_raw(RAW_TEST_PATH,8,8,&source));
+    CHECK(source.levels.size() == 4);
+    CHECK(!source.generateMips);
+
+    // Not even level 0
+    write_file(RAW_TEST_PATH,std::vector<uint8_t>(63,0));
+    CHECK(!texture_load_raw(RAW_TEST_PATH,8,8,&source));
+
+    CHECK(!texture_load_raw(KTX2_TEST_PATH,8,8,&source)); // not a raw extension
+}
+
+static WGPUTextureDescriptor texture_desc(WGPUTextureFormat format, uint32_t width, uint32_t height, uint32_t layers,
+                                          uint32_t mipLevelCount) {
+    WGPUTextureDescriptor desc = {};
+    desc.dimension = WGPUTextureDimension_2D;
+    desc.format = format;
+    desc.size = {width, height, layers};
+    desc.mipLevelCount = mipLevelCount;
+    desc.sampleCount = 1;
+    return desc;
+}
+
+static void test_texture_size_bytes() {
+    WGPUTextureDescriptor desc = texture_desc(WGPUTextureFormat_RGBA8Unorm,4,4,1,3);
+    CHECK(texture_size_bytes(&desc) == 64 + 16 + 4);
+
+    desc = texture_desc(WGPUTextureFormat_BC7RGBAUnorm,1024,1024,1,1);
+    CHECK(texture_size_bytes(&desc) == 1024 * 1024);
+
+    // Blocks are whole even when the level is smaller than one
+    desc = texture_desc(WGPUTextureFormat_BC1RGBAUnorm,4,4,1,3);
+    CHECK(texture_size_bytes(&desc) == 3 * 8);
+
+    // Array layers stay, 3D depth halves with the level
+    desc = texture_desc(WGPUTextureFormat_RGBA8Unorm,4,4,6,2);
+    CHECK(texture_size_bytes(&desc) == 6 * (64 + 16));
+    desc.dimension = WGPUTextureDimension_3D;
+    desc.size.depthOrArrayLayers = 4;
+    desc.mipLevelCount = 3;
+    CHECK(texture_size_bytes(&desc) == 4 * 64 + 2 * 16 + 4);
+
+    desc = texture_desc(WGPUTextureFormat_Depth32Float,16,16,0,1);
+    desc.sampleCount = 4;
+    CHECK(texture_size_bytes(&desc) == 16 * 16 * 4 * 4);
+}
+
+int main() {
+    test_ktx2_valid();
+    test_ktx2_truncated();
+    test_ktx2_bad_levels();
+    test_raw();
+    test_texture_size_bytes();
+    remove(KTX2_TEST_PATH);
+    remove(RAW_TEST_PATH);
+    return test_failures;
+}